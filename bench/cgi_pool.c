@@ -0,0 +1,118 @@
+/*
+ * cgi_pool.c: Measures dynamic request throughput and latency, to compare
+ * fork + exec per request against the persistent CGI pool.
+ *
+ * Each thread sends its requests one at a time on fresh connections and
+ * times them from connect to EOF. output.cgi?0 makes the CGI itself do no
+ * work, so what is left is process startup versus the pool round trip.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -o cgi_pool bench/cgi_pool.c segel.c -lpthread -lm
+ * then run it once against each server:
+ *   ./server 8080 8 64 block                  &  ./cgi_pool localhost 8080
+ *   ./server 8080 8 64 block --cgi-pool 8     &  ./cgi_pool localhost 8080
+ * Optional further arguments: threads (8), requests per thread (500), uri.
+ */
+
+#include "../segel.h"
+
+typedef struct loadArgs {
+    char *host;
+    int port;
+    char *uri;
+    int requests;
+    double *latencies;      /* one slot per request, in seconds */
+    int failures;
+} loadArgs;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int fetch(loadArgs *args)
+{
+    char buf[MAXBUF];
+    int fd = open_clientfd(args->host, args->port);
+    if (fd < 0)
+        return -1;
+
+    int len = sprintf(buf, "GET %s HTTP/1.0\r\n\r\n", args->uri);
+    if (rio_writen(fd, buf, len) != len) {
+        close(fd);
+        return -1;
+    }
+    ssize_t n, total = 0;
+    int ok = 0;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (total == 0)
+            ok = n >= 12 && strncmp(buf + 8, " 200", 4) == 0;
+        total += n;
+    }
+    close(fd);
+    return (n == 0 && ok) ? 0 : -1;
+}
+
+static void *load(void *arg)
+{
+    loadArgs *args = (loadArgs *)arg;
+    for (int i = 0; i < args->requests; i++) {
+        double start = now();
+        if (fetch(args) < 0)
+            args->failures++;
+        args->latencies[i] = now() - start;
+    }
+    return NULL;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <host> <port> [threads] [requests] [uri]\n", argv[0]);
+        exit(1);
+    }
+    int threads = argc > 3 ? atoi(argv[3]) : 8;
+    int requests = argc > 4 ? atoi(argv[4]) : 500;
+    char *uri = argc > 5 ? argv[5] : "/output.cgi?0";
+
+    pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+    loadArgs *args = calloc(threads, sizeof(loadArgs));
+    double *latencies = malloc(sizeof(double) * threads * requests);
+
+    signal(SIGPIPE, SIG_IGN);
+    double start = now();
+    for (int i = 0; i < threads; i++) {
+        args[i].host = argv[1];
+        args[i].port = atoi(argv[2]);
+        args[i].uri = uri;
+        args[i].requests = requests;
+        args[i].latencies = latencies + (size_t)i * requests;
+        pthread_create(&tids[i], NULL, load, &args[i]);
+    }
+    int failures = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        failures += args[i].failures;
+    }
+    double secs = now() - start;
+
+    int total = threads * requests;
+    double sum = 0;
+    qsort(latencies, total, sizeof(double), compareDouble);
+    for (int i = 0; i < total; i++)
+        sum += latencies[i];
+
+    printf("%-8s %8s %10s %10s %10s %10s\n",
+           "threads", "requests", "failed", "req/s", "mean(ms)", "p99(ms)");
+    printf("%-8d %8d %10d %10.0f %10.3f %10.3f\n", threads, total, failures,
+           total / secs, sum / total * 1e3, latencies[(int)(total * 0.99)] * 1e3);
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * cgi_spawn.c: Compares the two per-request CGI launch paths of
+ * requestServeDynamic as the parent's resident set grows.
+ *
+ *   fork:        Fork + Setenv + Dup2 + Execve in the child, WaitPid
+ *   posix_spawn: Posix_spawn with a dup2 file action and a one-entry envp
+ *
+ * fork has to copy the parent's page tables, so its cost grows with RSS.
+ * posix_spawn (clone with CLONE_VM | CLONE_VFORK in glibc) does not.
+ * Each launch runs the given program, /bin/true by default, with stdout
+ * sent to /dev/null. The time covers everything up to the child's exit.
+ *
+ * Build and run from the repository root:
+ *   gcc -O2 -o cgi_spawn bench/cgi_spawn.c segel.c -lpthread
+ *   ./cgi_spawn [program]
+ */
+
+#include "../segel.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void spawnFork(char *program, int fd)
+{
+    pid_t pid;
+    if ((pid = Fork()) == 0) {
+        Setenv("QUERY_STRING", "0", 1);
+        Dup2(fd, STDOUT_FILENO);
+        char *args[] = { program, NULL };
+        Execve(program, args, environ);
+    }
+    WaitPid(pid, NULL, 0);
+}
+
+static void spawnPosix(char *program, int fd)
+{
+    char *args[] = { program, NULL };
+    char *envp[] = { "QUERY_STRING=0", NULL };
+    posix_spawn_file_actions_t actions;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fd, STDOUT_FILENO);
+    pid_t pid = Posix_spawn(program, &actions, NULL, args, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    WaitPid(pid, NULL, 0);
+}
+
+int main(int argc, char *argv[])
+{
+    char *program = argc > 1 ? argv[1] : "/bin/true";
+    size_t steps[] = { 0, 64, 256, 1024 };  /* extra resident MB */
+    int iters = 300;
+    char *ballast = NULL;
+    size_t held = 0;
+    int fd = Open("/dev/null", O_WRONLY, 0);
+
+    struct { char *name; void (*fn)(char *, int); } methods[] = {
+        { "fork",        spawnFork },
+        { "posix_spawn", spawnPosix },
+    };
+
+    printf("%-8s %-12s %7s %12s\n", "rss(MB)", "method", "iters", "us/spawn");
+    for (int s = 0; s < 4; s++) {
+        size_t bytes = steps[s] << 20;
+        if (bytes > held) {
+            ballast = realloc(ballast, bytes);
+            if (ballast == NULL)
+                unix_error("realloc error");
+            memset(ballast + held, 1, bytes - held);   /* make it resident */
+            held = bytes;
+        }
+        for (int m = 0; m < 2; m++) {
+            methods[m].fn(program, fd);
+            double start = now();
+            for (int i = 0; i < iters; i++)
+                methods[m].fn(program, fd);
+            double secs = now() - start;
+            printf("%-8zu %-12s %7d %12.1f\n", steps[s], methods[m].name,
+                   iters, secs * 1e6 / iters);
+        }
+    }
+    free(ballast);
+    Close(fd);
+    return 0;
+}
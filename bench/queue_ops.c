@@ -0,0 +1,162 @@
+/*
+ * queue_ops.c: Times the queue.c operations the scheduler relies on, for
+ * linked lists (queueConstructor) and array-backed ones
+ * (queueConstructorArray), at queue sizes from 16 to 65536.
+ *
+ *   appendNewRequest  fill an empty queue to n
+ *   removeFront       drain a queue of n, returning nodes to the pool
+ *   removeByValue     remove a random value from a queue of n
+ *   removeByIndex     remove a random index from a queue of n
+ *
+ * The two remove-by cases append the removed value again after each
+ * removal so the queue stays at n; the time covers both calls.
+ *
+ * Output is CSV, one row per case: benchmark,case,n,ops,ns_per_op
+ * where n is the queue size.
+ *
+ * Build and run from the repository root:
+ *   gcc -O2 -o queue_ops bench/queue_ops.c queue.c -lpthread
+ *   ./queue_ops
+ */
+
+#include "../queue.h"
+#include <time.h>
+
+#define MIN_OPS     (1 << 20)
+#define MAX_SIZE    65536
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static List makeList(int array, int n)
+{
+    List list = array ? queueConstructorArray(n) : queueConstructor();
+    if (list == NULL) {
+        fprintf(stderr, "queue allocation failed\n");
+        exit(1);
+    }
+    return list;
+}
+
+static void fill(List list, int n)
+{
+    struct timeval arrival = { 0, 0 };
+    for (int i = 0; i < n; i++) {
+        appendNewRequest(list, i, arrival);
+    }
+}
+
+static void drain(List list)
+{
+    Node node;
+    while ((node = removeFront(list)) != NULL) {
+        nodeDestructor(node);
+    }
+}
+
+static void report(char *name, char *kind, int n, long ops, double secs)
+{
+    printf("queue_ops,%s/%s,%d,%ld,%.1f\n", name, kind, n, ops, secs * 1e9 / ops);
+}
+
+static void benchAppend(int array, int n)
+{
+    List list = makeList(array, n);
+    struct timeval arrival = { 0, 0 };
+    long ops = 0;
+    double secs = 0;
+    while (ops < MIN_OPS) {
+        double start = now();
+        for (int i = 0; i < n; i++) {
+            appendNewRequest(list, i, arrival);
+        }
+        secs += now() - start;
+        ops += n;
+        drain(list);
+    }
+    report("appendNewRequest", array ? "array" : "linked", n, ops, secs);
+    queueDestructor(list);
+}
+
+static void benchRemoveFront(int array, int n)
+{
+    List list = makeList(array, n);
+    long ops = 0;
+    double secs = 0;
+    while (ops < MIN_OPS) {
+        fill(list, n);
+        double start = now();
+        Node node;
+        while ((node = removeFront(list)) != NULL) {
+            nodeDestructor(node);
+        }
+        secs += now() - start;
+        ops += n;
+    }
+    report("removeFront", array ? "array" : "linked", n, ops, secs);
+    queueDestructor(list);
+}
+
+// Removals are O(n), so fewer of them are timed on long queues
+static long removeOps(int n)
+{
+    long ops = MIN_OPS / n;
+    return ops < 1024 ? 1024 : ops;
+}
+
+static void benchRemoveByValue(int array, int n)
+{
+    List list = makeList(array, n);
+    struct timeval arrival = { 0, 0 };
+    long ops = removeOps(n);
+    fill(list, n);
+    double start = now();
+    for (long i = 0; i < ops; i++) {
+        int value = rand() % n;
+        removeByValue(list, value);
+        appendNewRequest(list, value, arrival);
+    }
+    report("removeByValue", array ? "array" : "linked", n, ops, now() - start);
+    queueDestructor(list);
+}
+
+static void benchRemoveByIndex(int array, int n)
+{
+    List list = makeList(array, n);
+    struct timeval arrival = { 0, 0 };
+    long ops = removeOps(n);
+    fill(list, n);
+    double start = now();
+    for (long i = 0; i < ops; i++) {
+        int value = removeByIndex(list, rand() % n);
+        appendNewRequest(list, value, arrival);
+    }
+    report("removeByIndex", array ? "array" : "linked", n, ops, now() - start);
+    queueDestructor(list);
+}
+
+int main()
+{
+    int sizes[] = { 16, 256, 4096, MAX_SIZE };
+
+    // Preallocated nodes, as the server sets them up
+    if (queuePoolInit(MAX_SIZE + 1) < 0) {
+        fprintf(stderr, "queuePoolInit failed\n");
+        return 1;
+    }
+    srand(1);
+    printf("benchmark,case,n,ops,ns_per_op\n");
+    for (int array = 0; array < 2; array++) {
+        for (int s = 0; s < 4; s++) {
+            benchAppend(array, sizes[s]);
+            benchRemoveFront(array, sizes[s]);
+            benchRemoveByValue(array, sizes[s]);
+            benchRemoveByIndex(array, sizes[s]);
+        }
+    }
+    return 0;
+}
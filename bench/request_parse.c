@@ -0,0 +1,129 @@
+/*
+ * request_parse.c: Times the parsing steps of requestHandle on canned
+ * requests, with no sockets involved.
+ *
+ *   parserRun          the whole head as if one recv() returned it, and
+ *                      split into 64 byte reads to time resuming
+ *   requestParseURI    static, dynamic (with query string) and "/" URIs;
+ *                      the URI is copied first, as the parse modifies it
+ *   requestGetFiletype html, jpg and unknown extensions
+ *
+ * request.c is included directly so its static helpers can be called.
+ *
+ * Output is CSV, one row per case: benchmark,case,n,ops,ns_per_op
+ * where n is the size of the input in bytes.
+ *
+ * Build and run from the repository root:
+ *   gcc -O2 -o request_parse bench/request_parse.c segel.c queue.c cache.c header.c \
+ *       parser.c cgipool.c metrics.c -lpthread
+ *   ./request_parse [iterations]
+ */
+
+#include "../request.c"
+#include <time.h>
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(char *name, char *kind, int n, long ops, double secs)
+{
+    printf("request_parse,%s/%s,%d,%ld,%.1f\n", name, kind, n, ops, secs * 1e9 / ops);
+}
+
+static httpRequest req;
+
+static void benchParser(char *kind, char *request, int chunk, long iters)
+{
+    int len = strlen(request);
+
+    double start = now();
+    for (long i = 0; i < iters; i++) {
+        // What recv() calls of chunk bytes would append to the buffer
+        parserInit(&req);
+        int done = PARSER_MORE;
+        while (done == PARSER_MORE && req.len < len) {
+            int n = len - req.len < chunk ? len - req.len : chunk;
+            memcpy(req.buf + req.len, request + req.len, n);
+            req.len += n;
+            req.buf[req.len] = '\0';
+            done = parserRun(&req);
+        }
+        if (done != PARSER_DONE || req.status != 0) {
+            fprintf(stderr, "canned request %s did not parse\n", kind);
+            exit(1);
+        }
+    }
+    char name[64];
+    snprintf(name, sizeof(name), chunk < len ? "%s-split" : "%s", kind);
+    report("parserRun", name, len, iters, now() - start);
+}
+
+static void benchParseURI(char *kind, char *uri, long iters)
+{
+    char copy[MAXLINE], filename[MAXLINE], cgiargs[MAXLINE];
+    int len = strlen(uri);
+
+    double start = now();
+    for (long i = 0; i < iters; i++) {
+        memcpy(copy, uri, len + 1);
+        requestParseURI(copy, filename, cgiargs);
+    }
+    report("requestParseURI", kind, len, iters, now() - start);
+}
+
+static void benchFiletype(char *kind, char *filename, long iters)
+{
+    char filetype[MAXLINE];
+    volatile char sink = 0;
+
+    double start = now();
+    for (long i = 0; i < iters; i++) {
+        requestGetFiletype(filename, filetype);
+        sink += filetype[0];
+    }
+    report("requestGetFiletype", kind, strlen(filename), iters, now() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    long iters = argc > 1 ? atol(argv[1]) : 1000000;
+
+    char *minimal = "GET /home.html HTTP/1.0\r\n\r\n";
+    char *keepalive =
+        "GET /home.html HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "Connection: keep-alive\r\n\r\n";
+    char *browser =
+        "GET /images/logo.jpg HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+        "Accept: image/avif,image/webp,image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+        "Referer: http://localhost:8080/home.html\r\n"
+        "Connection: keep-alive\r\n"
+        "Cookie: session=5f2b8c1e9a7d4e3f; theme=dark\r\n"
+        "Sec-Fetch-Dest: image\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Priority: u=5, i\r\n\r\n";
+
+    printf("benchmark,case,n,ops,ns_per_op\n");
+    benchParser("minimal", minimal, MAXLINE, iters);
+    benchParser("keepalive", keepalive, MAXLINE, iters);
+    benchParser("browser", browser, MAXLINE, iters);
+    benchParser("browser", browser, 64, iters);
+
+    benchParseURI("static", "/images/logo.jpg", iters);
+    benchParseURI("dynamic", "/output.cgi?0.25", iters);
+    benchParseURI("directory", "/docs/", iters);
+
+    benchFiletype("html", "./public/home.html", iters);
+    benchFiletype("jpg", "./public/images/logo.jpg", iters);
+    benchFiletype("other", "./public/notes.txt", iters);
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * sched_cycle.c: Times the enqueue / dequeue / complete cycle of the
+ * lock handoff (dispatchConnection and ThreadFunction in server.c) with
+ * 1 to 128 worker threads contending for global_lock.
+ *
+ * One producer plays the acceptor: it waits on write_allowed while the
+ * queue is full, appends and signals read_allowed. Each worker waits on
+ * read_allowed, moves the front request to the running list, then takes
+ * the lock again to remove it and signal write_allowed, exactly like
+ * ThreadFunction does around requestHandle. Requests carry no work, so
+ * what is measured is the handoff itself.
+ *
+ * Output is CSV, one row per thread count: benchmark,case,n,ops,ns_per_op
+ * where n is the number of workers and ns_per_op the wall time per request.
+ *
+ * Build and run from the repository root:
+ *   gcc -O2 -o sched_cycle bench/sched_cycle.c queue.c -lpthread
+ *   ./sched_cycle [queue_size] [requests]
+ */
+
+#include "../queue.h"
+#include <time.h>
+
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t read_allowed = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t write_allowed = PTHREAD_COND_INITIALIZER;
+static List waiting_requests;
+static List running_requests;
+static int queue_size;
+static int remaining;       // requests workers have yet to take
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg)
+{
+    int id = (int)(long)arg;
+    while (1) {
+        pthread_mutex_lock(&global_lock);
+        while (getSize(waiting_requests) == 0 && remaining > 0) {
+            pthread_cond_wait(&read_allowed, &global_lock);
+        }
+        if (remaining == 0) {
+            pthread_mutex_unlock(&global_lock);
+            return NULL;
+        }
+        remaining--;
+        if (remaining == 0) {
+            pthread_cond_broadcast(&read_allowed);
+        }
+        Node node = removeFront(waiting_requests);
+        append(running_requests, node, id);
+        pthread_mutex_unlock(&global_lock);
+
+        pthread_mutex_lock(&global_lock);
+        removeNode(running_requests, node);
+        pthread_cond_signal(&write_allowed);
+        pthread_mutex_unlock(&global_lock);
+    }
+}
+
+static void producer(int requests)
+{
+    struct timeval arrival = { 0, 0 };
+    for (int i = 0; i < requests; i++) {
+        pthread_mutex_lock(&global_lock);
+        while (getSize(waiting_requests) + getSize(running_requests) >= queue_size) {
+            pthread_cond_wait(&write_allowed, &global_lock);
+        }
+        appendNewRequest(waiting_requests, i, arrival);
+        pthread_cond_signal(&read_allowed);
+        pthread_mutex_unlock(&global_lock);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    queue_size = argc > 1 ? atoi(argv[1]) : 64;
+    int requests = argc > 2 ? atoi(argv[2]) : 200000;
+
+    if (queue_size < 1 || requests < 1 || queuePoolInit(queue_size + 1) < 0) {
+        fprintf(stderr, "Usage: %s [queue_size] [requests]\n", argv[0]);
+        return 1;
+    }
+    waiting_requests = queueConstructor();
+    running_requests = queueConstructor();
+
+    printf("benchmark,case,n,ops,ns_per_op\n");
+    for (int threads = 1; threads <= 128; threads *= 2) {
+        pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+        remaining = requests;
+
+        double start = now();
+        for (int i = 0; i < threads; i++) {
+            pthread_create(&tids[i], NULL, worker, (void *)(long)i);
+        }
+        producer(requests);
+        for (int i = 0; i < threads; i++) {
+            pthread_join(tids[i], NULL);
+        }
+        double secs = now() - start;
+
+        printf("sched_cycle,lock/queue%d,%d,%d,%.1f\n", queue_size, threads,
+               requests, secs * 1e9 / requests);
+        free(tids);
+    }
+    return 0;
+}
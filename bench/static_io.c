@@ -0,0 +1,130 @@
+/*
+ * static_io.c: Compares the two requestServeStatic transfer paths.
+ *
+ *   mmap:     Open + Mmap + Rio_writen(header) + Rio_writen(body) + Munmap
+ *   sendfile: Open + send(header, MSG_MORE) + sendfile(body)
+ *
+ * Each transfer goes over a loopback TCP connection whose other end is
+ * drained by a separate thread, for 4 KB, 1 MB and 100 MB files.
+ *
+ * Build and run from the repository root:
+ *   gcc -O2 -o static_io bench/static_io.c segel.c -lpthread
+ *   ./static_io [dir-for-temp-files]
+ */
+
+#include "../segel.h"
+#include <netinet/tcp.h>
+
+#define HEADER_SIZE 300
+
+static void *drain(void *arg)
+{
+    int fd = *(int *)arg;
+    char buf[1 << 16];
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    return NULL;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void connectPair(int *sender, int *receiver)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int lfd = Socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Bind(lfd, (SA *)&addr, sizeof(addr));
+    Listen(lfd, 1);
+    getsockname(lfd, (SA *)&addr, &len);
+
+    *sender = Socket(AF_INET, SOCK_STREAM, 0);
+    Connect(*sender, (SA *)&addr, sizeof(addr));
+    *receiver = Accept(lfd, NULL, NULL);
+    Close(lfd);
+}
+
+static void sendMmap(int fd, char *path, size_t size, char *header)
+{
+    int srcfd = Open(path, O_RDONLY, 0);
+    char *srcp = Mmap(0, size, PROT_READ, MAP_PRIVATE, srcfd, 0);
+    Close(srcfd);
+    Rio_writen(fd, header, HEADER_SIZE);
+    Rio_writen(fd, srcp, size);
+    Munmap(srcp, size);
+}
+
+static void sendSendfile(int fd, char *path, size_t size, char *header)
+{
+    off_t offset = 0;
+    int srcfd = Open(path, O_RDONLY, 0);
+    if (send(fd, header, HEADER_SIZE, MSG_MORE) != HEADER_SIZE)
+        unix_error("send error");
+    while (offset < (off_t)size)
+        Sendfile(fd, srcfd, &offset, size - offset);
+    Close(srcfd);
+}
+
+static void run(char *dir, size_t size, int iters)
+{
+    char path[MAXLINE], header[HEADER_SIZE];
+    char chunk[1 << 16];
+
+    sprintf(path, "%s/static_io_%zu.bin", dir, size);
+    int fd = Open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    memset(chunk, 'x', sizeof(chunk));
+    for (size_t left = size; left > 0; ) {
+        size_t n = left < sizeof(chunk) ? left : sizeof(chunk);
+        Write(fd, chunk, n);
+        left -= n;
+    }
+    Close(fd);
+    memset(header, 'h', sizeof(header));
+
+    struct { char *name; void (*fn)(int, char *, size_t, char *); } methods[] = {
+        { "mmap",     sendMmap },
+        { "sendfile", sendSendfile },
+    };
+
+    for (int m = 0; m < 2; m++) {
+        int sender, receiver;
+        pthread_t tid;
+        connectPair(&sender, &receiver);
+        pthread_create(&tid, NULL, drain, &receiver);
+
+        methods[m].fn(sender, path, size, header);  /* warm the page cache */
+        double start = now();
+        for (int i = 0; i < iters; i++) {
+            methods[m].fn(sender, path, size, header);
+        }
+        double secs = now() - start;
+
+        Close(sender);
+        pthread_join(tid, NULL);
+        Close(receiver);
+
+        printf("%-10zu %-9s %7d %12.2f %12.1f\n", size, methods[m].name, iters,
+               secs * 1e6 / iters, (double)size * iters / secs / (1 << 20));
+    }
+    unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+    char *dir = argc > 1 ? argv[1] : "/tmp";
+
+    signal(SIGPIPE, SIG_IGN);
+    printf("%-10s %-9s %7s %12s %12s\n", "bytes", "method", "iters", "us/op", "MB/s");
+    run(dir, 4 << 10, 20000);
+    run(dir, 1 << 20, 2000);
+    run(dir, 100 << 20, 20);
+    return 0;
+}
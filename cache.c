@@ -0,0 +1,200 @@
+#include "segel.h"
+#include "cache.h"
+
+#define CACHE_BUCKETS 1024
+
+struct CacheEntry {
+    char *filename;
+    char *data;
+    size_t size;
+    struct timespec mtime;
+    int refs;
+    int resident;               // still reachable from the table
+    struct CacheEntry *hnext;   // hash chain
+    struct CacheEntry *prev;    // LRU list, most recent first
+    struct CacheEntry *next;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct CacheEntry *buckets[CACHE_BUCKETS];
+static struct CacheEntry *lru_head = NULL;
+static struct CacheEntry *lru_tail = NULL;
+static size_t budget = 0;
+static cacheStats stats;
+
+static unsigned int hashName(const char *s)
+{
+    unsigned int h = 2166136261u;
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+    return h % CACHE_BUCKETS;
+}
+
+static int isFresh(CacheEntry e, struct stat *sbuf)
+{
+    return e->size == (size_t)sbuf->st_size &&
+           e->mtime.tv_sec == sbuf->st_mtim.tv_sec &&
+           e->mtime.tv_nsec == sbuf->st_mtim.tv_nsec;
+}
+
+static void entryFree(CacheEntry e)
+{
+    free(e->filename);
+    free(e->data);
+    free(e);
+}
+
+static void lruUnlink(CacheEntry e)
+{
+    if (e->prev) e->prev->next = e->next; else lru_head = e->next;
+    if (e->next) e->next->prev = e->prev; else lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lruPushFront(CacheEntry e)
+{
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) lru_head->prev = e; else lru_tail = e;
+    lru_head = e;
+}
+
+// Takes e out of the table. Memory goes once the last reader releases it.
+// Caller holds cache_lock.
+static void entryDetach(CacheEntry e)
+{
+    struct CacheEntry **pp = &buckets[hashName(e->filename)];
+    while (*pp != e) {
+        pp = &(*pp)->hnext;
+    }
+    *pp = e->hnext;
+    lruUnlink(e);
+    e->resident = 0;
+    stats.bytes -= e->size;
+    stats.entries--;
+    if (e->refs == 0) {
+        entryFree(e);
+    }
+}
+
+static CacheEntry lookup(const char *filename)
+{
+    CacheEntry e = buckets[hashName(filename)];
+    while (e != NULL && strcmp(e->filename, filename) != 0) {
+        e = e->hnext;
+    }
+    return e;
+}
+
+// Reads the whole file outside the lock. Returns NULL if it changed
+// size since the caller's stat or could not be read.
+static CacheEntry load(const char *filename, struct stat *sbuf)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat now;
+    CacheEntry e = (CacheEntry)calloc(1, sizeof(*e));
+    if (e == NULL || fstat(fd, &now) < 0 || now.st_size != sbuf->st_size) {
+        close(fd);
+        free(e);
+        return NULL;
+    }
+    e->size = now.st_size;
+    e->mtime = now.st_mtim;
+    e->filename = strdup(filename);
+    e->data = (char *)malloc(e->size ? e->size : 1);
+    if (e->filename == NULL || e->data == NULL ||
+        rio_readn(fd, e->data, e->size) != (ssize_t)e->size) {
+        close(fd);
+        entryFree(e);
+        return NULL;
+    }
+    close(fd);
+    return e;
+}
+
+void cacheInit(size_t bytes)
+{
+    budget = bytes;
+}
+
+CacheEntry cacheAcquire(const char *filename, struct stat *sbuf)
+{
+    if (budget == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry e = lookup(filename);
+    if (e != NULL) {
+        if (isFresh(e, sbuf)) {
+            e->refs++;
+            stats.hits++;
+            lruUnlink(e);
+            lruPushFront(e);
+            pthread_mutex_unlock(&cache_lock);
+            return e;
+        }
+        entryDetach(e);
+    }
+    stats.misses++;
+    pthread_mutex_unlock(&cache_lock);
+
+    if ((size_t)sbuf->st_size > budget) {
+        return NULL;
+    }
+    CacheEntry fresh = load(filename, sbuf);
+    if (fresh == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    // Another worker may have loaded the same file meanwhile
+    e = lookup(filename);
+    if (e != NULL) {
+        entryDetach(e);
+    }
+    while (stats.bytes + fresh->size > budget && lru_tail != NULL) {
+        entryDetach(lru_tail);
+        stats.evictions++;
+    }
+    unsigned int b = hashName(filename);
+    fresh->hnext = buckets[b];
+    buckets[b] = fresh;
+    fresh->resident = 1;
+    fresh->refs = 1;
+    lruPushFront(fresh);
+    stats.bytes += fresh->size;
+    stats.entries++;
+    pthread_mutex_unlock(&cache_lock);
+    return fresh;
+}
+
+void cacheRelease(CacheEntry entry)
+{
+    pthread_mutex_lock(&cache_lock);
+    if (--entry->refs == 0 && !entry->resident) {
+        entryFree(entry);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+char *cacheData(CacheEntry entry)
+{
+    return entry->data;
+}
+
+size_t cacheSize(CacheEntry entry)
+{
+    return entry->size;
+}
+
+void cacheGetStats(cacheStats *out)
+{
+    pthread_mutex_lock(&cache_lock);
+    *out = stats;
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,37 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Shared in-memory cache of static files, keyed by resolved filename.
+// Entries are reference counted: a worker holding one may write it to
+// a socket without any lock, even if it is evicted meanwhile.
+
+typedef struct CacheEntry *CacheEntry;
+
+typedef struct cacheStats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    size_t bytes;           // bytes held by resident entries
+    int entries;
+} cacheStats;
+
+// A budget of 0 disables the cache
+void cacheInit(size_t budget);
+
+// Returns a referenced entry for filename, loading it on a miss, or NULL
+// when the file cannot be cached. sbuf is the caller's fresh stat of the
+// file; entries whose size or mtime differ are treated as stale.
+CacheEntry cacheAcquire(const char *filename, struct stat *sbuf);
+
+void cacheRelease(CacheEntry entry);
+
+char *cacheData(CacheEntry entry);
+
+size_t cacheSize(CacheEntry entry);
+
+void cacheGetStats(cacheStats *stats);
+
+#endif // __CACHE_H__
@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include "segel.h"
+#include "cgipool.h"
+#include "cgiproto.h"
+#include <poll.h>
+
+typedef struct cgiWorker {
+    pid_t pid;
+    int sock;       // our end of the socketpair, -1 if not running
+    int busy;
+} cgiWorker;
+
+static cgiWorker *workers = NULL;
+static int pool_size = 0;
+static char pool_program[MAXLINE];
+static int pool_timeout_ms = 0;
+static int max_fds = 0;             // descriptor limit, for closing in the child
+static unsigned short next_request_id = 0;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_free = PTHREAD_COND_INITIALIZER;
+
+// Starts (or restarts) the process in slot w. Its end of the socketpair
+// becomes its stdin.
+static void spawnWorker(cgiWorker *w)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        perror("socketpair");
+        w->sock = -1;
+        return;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(sv[0]);
+        close(sv[1]);
+        w->sock = -1;
+        return;
+    }
+    if (pid == 0) {
+        // Keep only stdio: anything else the server had open (client
+        // sockets of other workers, descriptors opened before
+        // close-on-exec was set) must not outlive it in the worker
+        dup2(sv[1], STDIN_FILENO);
+        if (close_range(3, ~0U, 0) < 0) {
+            for (int fd = 3; fd < max_fds; fd++) {
+                close(fd);
+            }
+        }
+        char *args[] = { pool_program, CGI_POOL_ARG, NULL };
+        execve(pool_program, args, environ);
+        _exit(127);
+    }
+    close(sv[1]);
+    w->pid = pid;
+    w->sock = sv[0];
+}
+
+static void reapWorker(cgiWorker *w)
+{
+    if (w->sock >= 0) {
+        close(w->sock);
+        w->sock = -1;
+    }
+    kill(w->pid, SIGKILL);
+    waitpid(w->pid, NULL, 0);
+}
+
+void cgiPoolInit(const char *program, int size, int timeoutSec)
+{
+    pool_size = size;
+    if (size <= 0) {
+        return;
+    }
+    strncpy(pool_program, program, MAXLINE - 1);
+    pool_timeout_ms = timeoutSec * 1000;
+    max_fds = (int)sysconf(_SC_OPEN_MAX);
+    workers = (cgiWorker *)calloc(size, sizeof(cgiWorker));
+    if (workers == NULL) {
+        unix_error("calloc error");
+    }
+    for (int i = 0; i < size; i++) {
+        spawnWorker(&workers[i]);
+    }
+}
+
+int cgiPoolServes(const char *filename)
+{
+    return pool_size > 0 && strcmp(filename, pool_program) == 0;
+}
+
+static int sendFrame(int sock, int type, unsigned short id,
+                     const char *payload, unsigned int length, int passfd)
+{
+    cgiFrameHeader hdr = { CGI_FRAME_VERSION, type, id, length };
+    struct iovec iov[2] = {
+        { &hdr, sizeof(hdr) },
+        { (void *)payload, length },
+    };
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(int))];
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = length ? 2 : 1;
+    if (passfd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &passfd, sizeof(int));
+    }
+    ssize_t n;
+    while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+    return n == (ssize_t)(sizeof(hdr) + length) ? 0 : -1;
+}
+
+static long monotonicMillis()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+// Reads exactly n bytes unless the peer closes, fails or the deadline
+// (monotonic ms) passes first. Returns 0 on success, -1 otherwise.
+static int readBefore(int sock, void *buf, size_t n, long deadline)
+{
+    char *p = buf;
+    while (n > 0) {
+        long left = deadline - monotonicMillis();
+        if (left <= 0) {
+            return -1;
+        }
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        int ready = poll(&pfd, 1, (int)left);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            return -1;
+        }
+        ssize_t got = read(sock, p, n);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return -1;
+        }
+        p += got;
+        n -= got;
+    }
+    return 0;
+}
+
+static int readEnd(int sock, unsigned short id)
+{
+    cgiFrameHeader hdr;
+    int status;
+    long deadline = monotonicMillis() + pool_timeout_ms;
+    if (readBefore(sock, &hdr, sizeof(hdr), deadline) < 0 ||
+        hdr.version != CGI_FRAME_VERSION || hdr.type != CGI_END ||
+        hdr.requestId != id || hdr.length != sizeof(status) ||
+        readBefore(sock, &status, sizeof(status), deadline) < 0) {
+        return -1;
+    }
+    return status;
+}
+
+int cgiPoolRun(int clientfd, const char *query)
+{
+    if (pool_size <= 0) {
+        return CGI_POOL_UNAVAIL;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    cgiWorker *w = NULL;
+    while (w == NULL) {
+        for (int i = 0; i < pool_size; i++) {
+            if (!workers[i].busy) {
+                w = &workers[i];
+                break;
+            }
+        }
+        if (w == NULL) {
+            pthread_cond_wait(&pool_free, &pool_lock);
+        }
+    }
+    w->busy = 1;
+    unsigned short id = ++next_request_id;
+    pthread_mutex_unlock(&pool_lock);
+
+    char params[MAXLINE + 16];
+    int plen = snprintf(params, sizeof(params), "QUERY_STRING=%s", query) + 1;
+    if (plen > (int)sizeof(params)) {
+        plen = sizeof(params);
+    }
+
+    int rc = CGI_POOL_OK;
+    if (w->sock < 0 ||
+        sendFrame(w->sock, CGI_BEGIN, id, NULL, 0, clientfd) < 0) {
+        rc = CGI_POOL_UNAVAIL;
+    } else if (sendFrame(w->sock, CGI_PARAMS, id, params, plen, -1) < 0 ||
+               readEnd(w->sock, id) < 0) {
+        rc = CGI_POOL_FAILED;
+    }
+
+    if (rc != CGI_POOL_OK) {
+        // Dead, hung or confused: replace it before anyone else picks it
+        if (w->sock >= 0) {
+            reapWorker(w);
+        }
+        spawnWorker(w);
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    w->busy = 0;
+    pthread_cond_signal(&pool_free);
+    pthread_mutex_unlock(&pool_lock);
+    return rc;
+}
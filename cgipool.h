@@ -0,0 +1,23 @@
+#ifndef __CGIPOOL_H__
+#define __CGIPOOL_H__
+
+// Pre-spawned, long-lived CGI processes that serve requests over a
+// local socket (see cgiproto.h) instead of a fork + exec per request.
+
+#define CGI_POOL_OK         0
+#define CGI_POOL_UNAVAIL   -1   // not started; caller may fork instead
+#define CGI_POOL_FAILED    -2   // the process died mid-request
+
+// Starts size copies of program. A size of 0 leaves the pool disabled.
+// A process that has not finished a request timeoutSec seconds after it
+// was handed over is killed and replaced.
+void cgiPoolInit(const char *program, int size, int timeoutSec);
+
+// 1 if filename is served by the pool
+int cgiPoolServes(const char *filename);
+
+// Runs one request with its response going to clientfd. Crashed and
+// timed out processes are replaced before this returns.
+int cgiPoolRun(int clientfd, const char *query);
+
+#endif // __CGIPOOL_H__
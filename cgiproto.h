@@ -0,0 +1,30 @@
+#ifndef __CGIPROTO_H__
+#define __CGIPROTO_H__
+
+// Framing between the server and pooled CGI processes (FastCGI-like).
+//
+// Every message is a fixed header followed by `length` payload bytes.
+// For each request the server sends:
+//   CGI_BEGIN   no payload; the client socket travels with it (SCM_RIGHTS)
+//   CGI_PARAMS  "NAME=value\0" pairs, e.g. "QUERY_STRING=2\0"
+// and the CGI process writes its response straight to the client
+// socket, then answers with:
+//   CGI_END     4-byte exit status (0 = success)
+
+#define CGI_FRAME_VERSION 1
+
+#define CGI_BEGIN   1
+#define CGI_PARAMS  2
+#define CGI_END     3
+
+// argv[1] that starts a CGI program in pooled mode
+#define CGI_POOL_ARG "--pool"
+
+typedef struct cgiFrameHeader {
+    unsigned char version;
+    unsigned char type;
+    unsigned short requestId;
+    unsigned int length;
+} cgiFrameHeader;
+
+#endif // __CGIPROTO_H__
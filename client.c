@@ -10,9 +10,31 @@
  *   2) ./client <host> <port> <filename> REAL
  *        -> uses "REAL" for VIP requests
  *
+ * Given any --name value option it turns into a load generator instead:
+ *   3) ./client <host> <port> <filename> [method] --connections 64 --duration 10
+ *        -> closed loop: each connection sends its next request as soon
+ *           as the last response is in
+ *   4) ./client <host> <port> <filename> --rate 2000 --mix /a.html:9,/b.cgi:1
+ *        -> open loop: requests are due at a fixed rate whether or not the
+ *           server keeps up, and latency counts from when they were due
+ *
+ * Options:
+ *   --connections <n>   concurrent connections (1)
+ *   --threads <n>       threads sharing them (min(connections, 4))
+ *   --duration <sec>    how long to run (10)
+ *   --rate <req/s>      open loop at this total rate; 0 is closed loop (0)
+ *   --mix <uri:weight,...>  URIs to request, by weight (<filename>:1)
+ *   --vip <fraction>    share of requests sent as REAL (0, or 1 for REAL)
+ *   --keepalive <0|1>   reuse connections the server keeps open (0)
+ *   --format <text|csv|json>  report format (text)
+ *
+ * The report splits each latency into server queueing, taken from the
+ * Stat-Req-Dispatch header, and the rest: connecting, network, parsing
+ * and service.
  */
 
 #include "segel.h"
+#include <poll.h>
 
 /*
  * Send an HTTP request for the specified file and method.
@@ -70,10 +92,635 @@ void clientPrint(int fd)
     }
 }
 
+// --------------------------------------------------
+// Load generator
+// --------------------------------------------------
+#define MAX_URLS 64
+#define DRAIN_TIME 2000000  // us to wait for responses after the run
+
+typedef struct loadOptions {
+    int connections;
+    int threads;
+    double duration;
+    double rate;            // total req/s, 0 for closed loop
+    double vipFraction;
+    int keepAlive;
+    char *format;
+    char *urls[MAX_URLS];
+    int weights[MAX_URLS];
+    int urlCount;
+    int weightTotal;
+} loadOptions;
+
+// One finished request
+typedef struct sample {
+    long long latency;      // us, from when it was due to the last byte
+    long long queue;        // us in the server's queue, -1 if not reported
+    char vip;
+} sample;
+
+// A connection and the request outstanding on it, if any
+typedef struct conn {
+    int fd;                 // -1 while not connected
+    int busy;
+    int connecting;         // connect in progress, request not sent yet
+    int url;                // index of the request's URI in opts.urls
+    int vip;
+    long long due;          // when the request was due (open loop) or sent
+    long long retryAt;      // after a failed connect
+    char buf[MAXBUF];       // response header block
+    int len;
+    int headerLen;          // -1 until the blank line has arrived
+    int status;
+    long long length;       // Content-Length, -1 if absent
+    long long body;         // body bytes read
+    long long queue;
+    int reusable;
+} conn;
+
+typedef struct loadThread {
+    pthread_t tid;
+    int id;
+    conn *conns;
+    int connCount;
+    double rate;            // this thread's share
+    sample *samples;
+    int sampleCount;
+    int sampleCap;
+    int vipErrors;
+    int errors;
+    unsigned int seed;
+} loadThread;
+
+static loadOptions opts;
+static struct sockaddr_in server_addr;
+static long long start_time, end_time;
+
+static long long now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void loadUsage(char *prog)
+{
+    fprintf(stderr, "Usage: %s <host> <port> <filename> [method] [--connections n] "
+            "[--threads n] [--duration sec] [--rate req/s] [--mix uri:weight,...] "
+            "[--vip fraction] [--keepalive 0|1] [--format text|csv|json]\n", prog);
+    exit(1);
+}
+
+static void addUrl(char *prog, char *uri, int weight)
+{
+    if (opts.urlCount == MAX_URLS || weight <= 0) {
+        loadUsage(prog);
+    }
+    opts.urls[opts.urlCount] = uri;
+    opts.weights[opts.urlCount] = weight;
+    opts.urlCount++;
+    opts.weightTotal += weight;
+}
+
+// "uri:weight,uri:weight"; a URI without a weight counts once
+static void parseMix(char *prog, char *value)
+{
+    for (char *item = strtok(value, ","); item != NULL; item = strtok(NULL, ",")) {
+        char *colon = strrchr(item, ':');
+        int weight = 1;
+        if (colon != NULL) {
+            *colon = '\0';
+            weight = atoi(colon + 1);
+        }
+        addUrl(prog, item, weight);
+    }
+}
+
+static void parseLoadOptions(int argc, char *argv[], int first, char *filename, char *method)
+{
+    opts.connections = 1;
+    opts.threads = 0;
+    opts.duration = 10;
+    opts.rate = 0;
+    opts.vipFraction = strcasecmp(method, "REAL") ? 0 : 1;
+    opts.keepAlive = 0;
+    opts.format = "text";
+
+    char *mix = NULL;
+    for (int i = first; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            loadUsage(argv[0]);
+        }
+        char *name = argv[i], *value = argv[i + 1];
+        if (!strcmp(name, "--connections")) {
+            opts.connections = atoi(value);
+        } else if (!strcmp(name, "--threads")) {
+            opts.threads = atoi(value);
+        } else if (!strcmp(name, "--duration")) {
+            opts.duration = atof(value);
+        } else if (!strcmp(name, "--rate")) {
+            opts.rate = atof(value);
+        } else if (!strcmp(name, "--mix")) {
+            mix = value;
+        } else if (!strcmp(name, "--vip")) {
+            opts.vipFraction = atof(value);
+        } else if (!strcmp(name, "--keepalive")) {
+            opts.keepAlive = atoi(value) != 0;
+        } else if (!strcmp(name, "--format")) {
+            opts.format = value;
+        } else {
+            loadUsage(argv[0]);
+        }
+    }
+    if (mix != NULL) {
+        parseMix(argv[0], mix);
+    } else {
+        addUrl(argv[0], filename, 1);
+    }
+
+    if (opts.connections < 1 || opts.duration <= 0 || opts.rate < 0 ||
+        opts.vipFraction < 0 || opts.vipFraction > 1 ||
+        (strcmp(opts.format, "text") && strcmp(opts.format, "csv") &&
+         strcmp(opts.format, "json"))) {
+        loadUsage(argv[0]);
+    }
+    if (opts.threads <= 0) {
+        opts.threads = opts.connections < 4 ? opts.connections : 4;
+    }
+    if (opts.threads > opts.connections) {
+        opts.threads = opts.connections;
+    }
+}
+
+static void resolve(char *host, int port)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(host, NULL, &hints, &res);
+    if (rc != 0) {
+        fprintf(stderr, "Error: could not resolve %s: %s\n", host, gai_strerror(rc));
+        exit(1);
+    }
+    server_addr = *(struct sockaddr_in *)res->ai_addr;
+    server_addr.sin_port = htons(port);
+    freeaddrinfo(res);
+}
+
+static void connClose(conn *c)
+{
+    if (c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+static void addSample(loadThread *t, conn *c, long long end)
+{
+    if (t->sampleCount == t->sampleCap) {
+        t->sampleCap = t->sampleCap ? 2 * t->sampleCap : 4096;
+        t->samples = (sample *)realloc(t->samples, t->sampleCap * sizeof(sample));
+        if (t->samples == NULL) {
+            unix_error("realloc error");
+        }
+    }
+    sample *s = &t->samples[t->sampleCount++];
+    s->latency = end - c->due;
+    s->queue = c->queue;
+    s->vip = c->vip;
+}
+
+static void countError(loadThread *t, conn *c)
+{
+    t->errors++;
+    if (c->vip) {
+        t->vipErrors++;
+    }
+}
+
+// Sends the request chosen for c on its connected socket. Returns -1,
+// with c closed, if it could not be sent.
+static int connSend(conn *c)
+{
+    char req[MAXLINE];
+    int n = snprintf(req, sizeof(req), "%s %s %s\r\n%s\r\n",
+                     c->vip ? "REAL" : "GET", opts.urls[c->url],
+                     opts.keepAlive ? "HTTP/1.1" : "HTTP/1.0",
+                     opts.keepAlive ? "Connection: keep-alive\r\n" : "");
+    // A request this small always fits in an empty socket buffer
+    if (send(c->fd, req, n, MSG_NOSIGNAL) != n) {
+        connClose(c);
+        return -1;
+    }
+    return 0;
+}
+
+// Starts a request on c that was due at the given time. A new
+// connection is made without blocking the thread: the request goes out
+// once connFinish sees it established, and its latency still counts
+// from due. Returns -1 if the connection could not be made or the
+// request not sent.
+static int connStart(loadThread *t, conn *c, long long due)
+{
+    int pick = rand_r(&t->seed) % opts.weightTotal, u = 0;
+    while (pick >= opts.weights[u]) {
+        pick -= opts.weights[u++];
+    }
+    c->url = u;
+    c->vip = rand_r(&t->seed) < opts.vipFraction * ((double)RAND_MAX + 1);
+
+    c->connecting = 0;
+    if (c->fd < 0) {
+        c->fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (c->fd < 0) {
+            return -1;
+        }
+        fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+        if (connect(c->fd, (SA *)&server_addr, sizeof(server_addr)) < 0) {
+            if (errno != EINPROGRESS) {
+                connClose(c);
+                return -1;
+            }
+            c->connecting = 1;
+        }
+    }
+    if (!c->connecting && connSend(c) < 0) {
+        return -1;
+    }
+    c->busy = 1;
+    c->due = due;
+    c->len = 0;
+    c->headerLen = -1;
+    c->status = 0;
+    c->length = -1;
+    c->body = 0;
+    c->queue = -1;
+    c->reusable = 0;
+    return 0;
+}
+
+// Called once c's pending connect is writable. Sends the request if
+// the connection was made; returns -1, with c closed, if not.
+static int connFinish(conn *c)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        connClose(c);
+        return -1;
+    }
+    c->connecting = 0;
+    return connSend(c);
+}
+
+static void parseHeaders(conn *c)
+{
+    sscanf(c->buf, "HTTP/%*d.%*d %d", &c->status);
+    // Error responses end their lines with a bare LF
+    for (char *line = strchr(c->buf, '\n'); line != NULL && line - c->buf < c->headerLen;
+         line = strchr(line + 1, '\n')) {
+        char *h = line + 1;
+        long sec, usec;
+        if (!strncasecmp(h, "Content-Length:", 15)) {
+            c->length = atoll(h + 15);
+        } else if (!strncasecmp(h, "Connection:", 11)) {
+            c->reusable = !strncasecmp(h + 11, " keep-alive", 11);
+        } else if (sscanf(h, "Stat-Req-Dispatch:: %ld.%ld", &sec, &usec) == 2) {
+            c->queue = sec * 1000000LL + usec;
+        }
+    }
+}
+
+// Reads what has arrived of the response on c. Returns 1 once it is
+// complete, 0 if more is to come and -1 if the connection failed.
+static int connRead(conn *c)
+{
+    char discard[MAXBUF];
+    while (1) {
+        char *dst = discard;
+        size_t room = sizeof(discard);
+        if (c->headerLen < 0) {
+            dst = c->buf + c->len;
+            room = sizeof(c->buf) - 1 - c->len;
+            if (room == 0) {
+                return -1;
+            }
+        }
+        ssize_t n = recv(c->fd, dst, room, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (n == 0) {
+            c->reusable = 0;
+            return (c->headerLen >= 0 && (c->length < 0 || c->body >= c->length)) ? 1 : -1;
+        }
+        if (c->headerLen < 0) {
+            c->len += n;
+            c->buf[c->len] = '\0';
+            char *end = strstr(c->buf, "\r\n\r\n");
+            char *lf = strstr(c->buf, "\n\n");
+            if (lf != NULL && (end == NULL || lf < end)) {
+                c->headerLen = lf + 2 - c->buf;
+            } else if (end != NULL) {
+                c->headerLen = end + 4 - c->buf;
+            } else {
+                continue;
+            }
+            parseHeaders(c);
+            c->body = c->len - c->headerLen;
+            // Failures are counted and their connection dropped, so the
+            // body does not matter
+            if (c->status != 200) {
+                c->reusable = 0;
+                return 1;
+            }
+        } else {
+            c->body += n;
+        }
+        if (c->length >= 0 && c->body >= c->length) {
+            return 1;
+        }
+    }
+}
+
+static void *loadThreadFunction(void *arg)
+{
+    loadThread *t = (loadThread *)arg;
+    struct pollfd *pfds = (struct pollfd *)malloc(t->connCount * sizeof(struct pollfd));
+    int *polled = (int *)malloc(t->connCount * sizeof(int));
+
+    // Open loop: requests due but not yet sent, oldest first
+    long long interval = t->rate > 0 ? (long long)(1e6 / t->rate) : 0;
+    long long nextDue = start_time + interval * t->id / opts.threads;
+    long long *backlog = NULL;
+    int backlogHead = 0, backlogLen = 0, backlogCap = 0;
+
+    int outstanding = 0;
+    while (1) {
+        // Past the end nothing new is sent, but what is in flight may
+        // finish for a little longer
+        long long time = now();
+        int ending = time >= end_time;
+        if (ending && (outstanding == 0 || time >= end_time + DRAIN_TIME)) {
+            break;
+        }
+        while (!ending && interval > 0 && nextDue <= time) {
+            if (backlogLen == backlogCap) {
+                memmove(backlog, backlog + backlogHead, (backlogLen - backlogHead) * sizeof(long long));
+                backlogLen -= backlogHead;
+                backlogHead = 0;
+                if (backlogLen == backlogCap) {
+                    backlogCap = backlogCap ? 2 * backlogCap : 1024;
+                    backlog = (long long *)realloc(backlog, backlogCap * sizeof(long long));
+                    if (backlog == NULL) {
+                        unix_error("realloc error");
+                    }
+                }
+            }
+            backlog[backlogLen++] = nextDue;
+            nextDue += interval;
+        }
+
+        int npoll = 0;
+        for (int i = 0; i < t->connCount; i++) {
+            conn *c = &t->conns[i];
+            if (!ending && !c->busy && c->retryAt <= time) {
+                long long due = time;
+                if (interval > 0) {
+                    if (backlogHead == backlogLen) {
+                        continue;
+                    }
+                    due = backlog[backlogHead++];
+                }
+                if (connStart(t, c, due) < 0) {
+                    countError(t, c);
+                    c->retryAt = time + 10000;
+                    continue;
+                }
+            }
+            if (c->busy) {
+                pfds[npoll].fd = c->fd;
+                pfds[npoll].events = c->connecting ? POLLOUT : POLLIN;
+                polled[npoll++] = i;
+            }
+        }
+        outstanding = npoll;
+
+        long long wake = ending ? end_time + DRAIN_TIME : end_time;
+        if (!ending && interval > 0 && nextDue < wake) {
+            wake = nextDue;
+        }
+        long long timeout = (wake - time + 999) / 1000;
+        if (timeout > 10) {
+            timeout = 10;   // also the retry granularity after a failed connect
+        }
+        if (poll(pfds, npoll, (int)timeout) <= 0) {
+            continue;
+        }
+        for (int p = 0; p < npoll; p++) {
+            if (pfds[p].revents == 0) {
+                continue;
+            }
+            conn *c = &t->conns[polled[p]];
+            if (c->connecting) {
+                if (connFinish(c) < 0) {
+                    c->busy = 0;
+                    countError(t, c);
+                    c->retryAt = time + 10000;
+                }
+                continue;
+            }
+            int rc = connRead(c);
+            if (rc == 0) {
+                continue;
+            }
+            c->busy = 0;
+            if (rc > 0 && c->status == 200) {
+                addSample(t, c, now());
+            } else {
+                countError(t, c);
+            }
+            if (rc < 0 || !opts.keepAlive || !c->reusable || c->status != 200) {
+                connClose(c);
+            }
+        }
+    }
+
+    // Whatever is still outstanding did not finish at all
+    for (int i = 0; i < t->connCount; i++) {
+        if (t->conns[i].busy) {
+            countError(t, &t->conns[i]);
+        }
+        connClose(&t->conns[i]);
+    }
+    free(backlog);
+    free(polled);
+    free(pfds);
+    return NULL;
+}
+
+static int compareLong(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(long long *sorted, int n, double q)
+{
+    if (n == 0) {
+        return 0;
+    }
+    int i = (int)(q * n);
+    return (i < n ? sorted[i] : sorted[n - 1]) / 1000.0;
+}
+
+#define REPORT_COLUMNS 12
+
+static const char *report_columns[REPORT_COLUMNS] = {
+    "requests", "errors", "req_per_sec",
+    "latency_p50_ms", "latency_p90_ms", "latency_p99_ms", "latency_p999_ms", "latency_max_ms",
+    "queue_p50_ms", "queue_p99_ms", "rest_p50_ms", "rest_p99_ms"
+};
+
+// Fills values[] for the samples of one group: -1 all, 0 regular, 1 VIP
+static void summarize(loadThread *threads, int group, double secs, double *values)
+{
+    int total = 0, errors = 0;
+    for (int i = 0; i < opts.threads; i++) {
+        total += threads[i].sampleCount;
+        errors += group < 0 ? threads[i].errors
+                : group ? threads[i].vipErrors : threads[i].errors - threads[i].vipErrors;
+    }
+    long long *lat = (long long *)malloc((total + 1) * sizeof(long long));
+    long long *queue = (long long *)malloc((total + 1) * sizeof(long long));
+    long long *rest = (long long *)malloc((total + 1) * sizeof(long long));
+    int n = 0, nq = 0;
+    for (int i = 0; i < opts.threads; i++) {
+        for (int j = 0; j < threads[i].sampleCount; j++) {
+            sample *s = &threads[i].samples[j];
+            if (group >= 0 && s->vip != group) {
+                continue;
+            }
+            lat[n++] = s->latency;
+            if (s->queue >= 0) {
+                queue[nq] = s->queue;
+                rest[nq++] = s->latency - s->queue;
+            }
+        }
+    }
+    qsort(lat, n, sizeof(long long), compareLong);
+    qsort(queue, nq, sizeof(long long), compareLong);
+    qsort(rest, nq, sizeof(long long), compareLong);
+
+    values[0] = n;
+    values[1] = errors;
+    values[2] = n / secs;
+    values[3] = percentile(lat, n, 0.5);
+    values[4] = percentile(lat, n, 0.9);
+    values[5] = percentile(lat, n, 0.99);
+    values[6] = percentile(lat, n, 0.999);
+    values[7] = n ? lat[n - 1] / 1000.0 : 0;
+    values[8] = percentile(queue, nq, 0.5);
+    values[9] = percentile(queue, nq, 0.99);
+    values[10] = percentile(rest, nq, 0.5);
+    values[11] = percentile(rest, nq, 0.99);
+    free(lat);
+    free(queue);
+    free(rest);
+}
+
+static void report(loadThread *threads, double secs)
+{
+    static const char *groups[] = { "all", "regular", "vip" };
+    double values[3][REPORT_COLUMNS];
+    for (int g = 0; g < 3; g++) {
+        summarize(threads, g - 1, secs, values[g]);
+    }
+
+    if (!strcmp(opts.format, "json")) {
+        printf("{\"mode\": \"%s\", \"connections\": %d, \"duration\": %.3f",
+               opts.rate > 0 ? "open" : "closed", opts.connections, secs);
+        for (int g = 0; g < 3; g++) {
+            printf(",\n \"%s\": {", groups[g]);
+            for (int k = 0; k < REPORT_COLUMNS; k++) {
+                printf("%s\"%s\": %.3f", k ? ", " : "", report_columns[k], values[g][k]);
+            }
+            printf("}");
+        }
+        printf("}\n");
+    } else if (!strcmp(opts.format, "csv")) {
+        printf("group");
+        for (int k = 0; k < REPORT_COLUMNS; k++) {
+            printf(",%s", report_columns[k]);
+        }
+        printf("\n");
+        for (int g = 0; g < 3; g++) {
+            printf("%s", groups[g]);
+            for (int k = 0; k < REPORT_COLUMNS; k++) {
+                printf(",%.3f", values[g][k]);
+            }
+            printf("\n");
+        }
+    } else {
+        printf("%s loop, %d connections, %.1f s\n",
+               opts.rate > 0 ? "open" : "closed", opts.connections, secs);
+        printf("%-8s %9s %7s %9s %9s %9s %9s %9s %9s\n", "group", "requests", "errors",
+               "req/s", "p50(ms)", "p99(ms)", "p999(ms)", "queue50", "queue99");
+        for (int g = 0; g < 3; g++) {
+            double *v = values[g];
+            printf("%-8s %9.0f %7.0f %9.0f %9.3f %9.3f %9.3f %9.3f %9.3f\n", groups[g],
+                   v[0], v[1], v[2], v[3], v[5], v[6], v[8], v[9]);
+        }
+    }
+}
+
+static void runLoad(char *host, int port)
+{
+    resolve(host, port);
+    signal(SIGPIPE, SIG_IGN);
+
+    loadThread *threads = (loadThread *)calloc(opts.threads, sizeof(loadThread));
+    conn *conns = (conn *)calloc(opts.connections, sizeof(conn));
+    if (threads == NULL || conns == NULL) {
+        unix_error("calloc error");
+    }
+    for (int i = 0; i < opts.connections; i++) {
+        conns[i].fd = -1;
+    }
+
+    start_time = now();
+    end_time = start_time + (long long)(opts.duration * 1e6);
+    int first = 0;
+    for (int i = 0; i < opts.threads; i++) {
+        loadThread *t = &threads[i];
+        t->id = i;
+        t->connCount = opts.connections / opts.threads + (i < opts.connections % opts.threads);
+        t->conns = conns + first;
+        first += t->connCount;
+        t->rate = opts.rate / opts.threads;
+        t->seed = (unsigned int)start_time + i;
+        pthread_create(&t->tid, NULL, loadThreadFunction, t);
+    }
+    for (int i = 0; i < opts.threads; i++) {
+        pthread_join(threads[i].tid, NULL);
+    }
+
+    report(threads, (now() - start_time) / 1e6);
+    for (int i = 0; i < opts.threads; i++) {
+        free(threads[i].samples);
+    }
+    free(conns);
+    free(threads);
+}
+
 int main(int argc, char *argv[])
 {
     if (argc < 4) {
-        fprintf(stderr, "Usage: %s <host> <port> <filename> [method]\n", argv[0]);
+        fprintf(stderr, "Usage: %s <host> <port> <filename> [method] [--option value ...]\n", argv[0]);
         exit(1);
     }
 
@@ -84,8 +731,17 @@ int main(int argc, char *argv[])
     // Optional 4th argument: HTTP method (e.g. REAL or GET).
     // If omitted, default to "GET".
     char *method = "GET";
-    if (argc >= 5) {
+    int first_option = 4;
+    if (argc >= 5 && strncmp(argv[4], "--", 2)) {
         method = argv[4];
+        first_option = 5;
+    }
+
+    // Any option makes this a load test
+    if (first_option < argc) {
+        parseLoadOptions(argc, argv, first_option, filename, method);
+        runLoad(host, port);
+        return 0;
     }
 
     /* Open a connection to the specified host and port */
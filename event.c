@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include "segel.h"
+#include "event.h"
+#include "ratelimit.h"
+#include "metrics.h"
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#define MAX_EVENTS 256
+
+// Which deadline list a connection is on
+#define LIST_NONE       0
+#define LIST_IDLE       1
+#define LIST_PENDING    2
+
+// Connections linked through connState.list_prev / list_next. All
+// members share one timeout, so the head is always the next to expire.
+typedef struct connList {
+    int head;
+    int tail;
+} connList;
+
+struct EventLoop {
+    int epfd;
+    int listenfd;
+    dispatchFunction dispatch;
+
+    // Keep-alive connections waiting for their next request, oldest first.
+    // Workers append under idle_lock; the loop thread unlinks and expires.
+    pthread_mutex_t idle_lock;
+    connList idle;
+
+    // New connections that have yet to send a full request head, oldest
+    // first. Only the loop thread touches it.
+    connList pending;
+};
+
+// Per-connection state, indexed by file descriptor.
+// Descriptors are unique process-wide, so one table serves every loop.
+struct connState {
+    EventLoop loop;
+    struct timeval arrival_time;
+    long long arrival_clock;    // the same moment on metricsClock()
+    long long parsed_clock;     // when the request head was complete
+    struct in_addr peer;
+    int requests;           // requests already served on this connection
+    int list;               // LIST_IDLE while parked, LIST_PENDING while new
+    long deadline;          // monotonic ms
+    int list_prev;
+    int list_next;
+    httpRequest *req;       // request head being read, kept with the slot
+};
+
+static struct connState *conns = NULL;
+static int conns_size = 0;
+
+static int keepalive_timeout = 0;   // seconds, 0 disables keep-alive
+static int keepalive_max = 100;
+static int header_timeout = 0;      // seconds, 0 lets new connections wait forever
+static inlineFunction inline_handler = NULL;
+
+static long monotonicMillis()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static void setNonBlocking(int fd, int on)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        unix_error("fcntl error");
+    }
+    flags = on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    if (fcntl(fd, F_SETFL, flags) < 0) {
+        unix_error("fcntl error");
+    }
+}
+
+static void connTableInit()
+{
+    if (conns != NULL) {
+        return;
+    }
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        unix_error("getrlimit error");
+    }
+    conns_size = (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > 1 << 20)
+                 ? 1 << 20 : (int)rl.rlim_cur;
+    conns = (struct connState *)calloc(conns_size, sizeof(*conns));
+    if (conns == NULL) {
+        unix_error("calloc error");
+    }
+}
+
+EventLoop eventLoopConstructor(int listenfd, dispatchFunction dispatch)
+{
+    EventLoop loop = (EventLoop)malloc(sizeof(*loop));
+    if (loop == NULL) {
+        return NULL;
+    }
+    connTableInit();
+
+    loop->listenfd = listenfd;
+    loop->dispatch = dispatch;
+    loop->idle.head = loop->idle.tail = -1;
+    loop->pending.head = loop->pending.tail = -1;
+    pthread_mutex_init(&loop->idle_lock, NULL);
+    if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        unix_error("epoll_create1 error");
+    }
+
+    setNonBlocking(listenfd, 1);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listenfd;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0) {
+        unix_error("epoll_ctl error");
+    }
+    return loop;
+}
+
+static void listAppend(connList *l, int fd, int list, long deadline)
+{
+    struct connState *c = &conns[fd];
+    c->list = list;
+    c->deadline = deadline;
+    c->list_next = -1;
+    c->list_prev = l->tail;
+    if (l->tail >= 0) {
+        conns[l->tail].list_next = fd;
+    } else {
+        l->head = fd;
+    }
+    l->tail = fd;
+}
+
+// For loop->idle the caller holds loop->idle_lock
+static void listUnlink(connList *l, int fd)
+{
+    struct connState *c = &conns[fd];
+    if (c->list_prev >= 0) {
+        conns[c->list_prev].list_next = c->list_next;
+    } else {
+        l->head = c->list_next;
+    }
+    if (c->list_next >= 0) {
+        conns[c->list_next].list_prev = c->list_prev;
+    } else {
+        l->tail = c->list_prev;
+    }
+    c->list = LIST_NONE;
+}
+
+// Drains the accept backlog. New sockets are watched edge-triggered,
+// so a partially sent request head only wakes us again on new data.
+static void acceptConnections(EventLoop loop)
+{
+    while (1) {
+        struct sockaddr_in clientaddr;
+        socklen_t clientlen = sizeof(clientaddr);
+        int connfd = accept4(loop->listenfd, (SA *)&clientaddr, &clientlen,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // EMFILE and friends: leave the rest in the backlog
+                perror("accept4");
+            }
+            return;
+        }
+        if (connfd >= conns_size) {
+            Close(connfd);
+            continue;
+        }
+        // A client out of tokens is turned away before it costs a slot
+        if (rateLimitEnabled() && !rateLimitConnect(clientaddr.sin_addr)) {
+            metricsCountDrop(DROP_RATELIMIT, 1);
+            Close(connfd);
+            continue;
+        }
+        if (conns[connfd].req == NULL &&
+            (conns[connfd].req = (httpRequest *)malloc(sizeof(httpRequest))) == NULL) {
+            Close(connfd);
+            continue;
+        }
+        parserInit(conns[connfd].req);
+        conns[connfd].peer = clientaddr.sin_addr;
+        gettimeofday(&conns[connfd].arrival_time, NULL);
+        conns[connfd].arrival_clock = metricsClock();
+        conns[connfd].loop = loop;
+        conns[connfd].requests = 0;
+        conns[connfd].list = LIST_NONE;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = connfd;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
+            perror("epoll_ctl");
+            Close(connfd);
+            continue;
+        }
+        // A client that connects and then stalls only costs a slot
+        // until its deadline
+        if (header_timeout > 0) {
+            listAppend(&loop->pending, connfd, LIST_PENDING,
+                       monotonicMillis() + header_timeout * 1000L);
+        }
+    }
+}
+
+static void handleClient(EventLoop loop, int fd, unsigned int events)
+{
+    // Reads whatever arrived and resumes parsing; only a complete (or
+    // invalid) head leaves the loop. On a kept-alive connection the next
+    // request arrives with its first bytes.
+    if (conns[fd].list == LIST_IDLE && conns[fd].req->len == 0) {
+        gettimeofday(&conns[fd].arrival_time, NULL);
+        conns[fd].arrival_clock = metricsClock();
+    }
+    int ready = parserRead(conns[fd].req, fd);
+    if (ready == PARSER_MORE && (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))) {
+        ready = -1;
+    }
+    if (ready == PARSER_MORE) {
+        return;
+    }
+
+    conns[fd].parsed_clock = metricsClock();
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+    if (conns[fd].list == LIST_PENDING) {
+        listUnlink(&loop->pending, fd);
+    } else if (conns[fd].list == LIST_IDLE) {
+        pthread_mutex_lock(&loop->idle_lock);
+        listUnlink(&loop->idle, fd);
+        pthread_mutex_unlock(&loop->idle_lock);
+    }
+    if (ready < 0) {
+        Close(fd);
+        return;
+    }
+    setNonBlocking(fd, 0);
+    if (inline_handler != NULL && inline_handler(fd, conns[fd].req)) {
+        return;
+    }
+    loop->dispatch(fd, conns[fd].arrival_time);
+}
+
+// Closes the connections on l whose deadline has passed and lowers
+// *timeout to the wait until the next one is due. Returns how many.
+static int expireList(EventLoop loop, connList *l, long now, int *timeout)
+{
+    int closed = 0;
+    while (l->head >= 0) {
+        int fd = l->head;
+        if (conns[fd].deadline > now) {
+            long left = conns[fd].deadline - now;
+            *timeout = left < *timeout ? (int)left : *timeout;
+            break;
+        }
+        listUnlink(l, fd);
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+        Close(fd);
+        closed++;
+    }
+    return closed;
+}
+
+// Closes parked connections whose idle timeout has passed and new ones
+// that did not deliver a request head in time.
+// Returns the epoll_wait timeout until the next one is due.
+static int expireConnections(EventLoop loop)
+{
+    if (keepalive_timeout == 0 && header_timeout == 0) {
+        return -1;
+    }
+    long now = monotonicMillis();
+    int timeout = 1000;
+
+    int evicted = expireList(loop, &loop->pending, now, &timeout);
+    if (evicted > 0) {
+        metricsCountDrop(DROP_TIMEOUT, evicted);
+    }
+    pthread_mutex_lock(&loop->idle_lock);
+    expireList(loop, &loop->idle, now, &timeout);
+    pthread_mutex_unlock(&loop->idle_lock);
+    return timeout;
+}
+
+void eventSetKeepAlive(int timeoutSec, int maxRequests)
+{
+    keepalive_timeout = timeoutSec;
+    keepalive_max = maxRequests;
+}
+
+void eventSetHeaderTimeout(int timeoutSec)
+{
+    header_timeout = timeoutSec;
+}
+
+void eventSetInlineHandler(inlineFunction handler)
+{
+    inline_handler = handler;
+}
+
+struct in_addr eventPeerAddr(int fd)
+{
+    return conns[fd].peer;
+}
+
+httpRequest *eventRequest(int fd)
+{
+    return conns[fd].req;
+}
+
+long long eventArrivalClock(int fd)
+{
+    return conns[fd].arrival_clock;
+}
+
+long long eventParsedClock(int fd)
+{
+    return conns[fd].parsed_clock;
+}
+
+int eventCanKeepAlive(int fd)
+{
+    return keepalive_timeout > 0 && conns[fd].requests + 1 < keepalive_max;
+}
+
+void eventPark(int fd)
+{
+    struct connState *c = &conns[fd];
+    EventLoop loop = c->loop;
+
+    c->requests++;
+    parserInit(c->req);
+    setNonBlocking(fd, 1);
+
+    pthread_mutex_lock(&loop->idle_lock);
+    listAppend(&loop->idle, fd, LIST_IDLE, monotonicMillis() + keepalive_timeout * 1000L);
+
+    // Registered under the lock so the loop cannot expire a half-parked fd
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        listUnlink(&loop->idle, fd);
+        Close(fd);
+    }
+    pthread_mutex_unlock(&loop->idle_lock);
+}
+
+void eventLoopRun(EventLoop loop)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        int n = epoll_wait(loop->epfd, events, MAX_EVENTS, expireConnections(loop));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            unix_error("epoll_wait error");
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == loop->listenfd) {
+                acceptConnections(loop);
+            } else {
+                handleClient(loop, events[i].data.fd, events[i].events);
+            }
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "parser.h"
+
+typedef struct EventLoop *EventLoop;
+
+// Called by the loop once a connection's request head has been read
+// and parsed (see eventRequest).
+// The descriptor is handed over in blocking mode and is no longer
+// watched by the loop.
+typedef void (*dispatchFunction)(int fd, struct timeval arrivalTime);
+
+EventLoop eventLoopConstructor(int listenfd, dispatchFunction dispatch);
+
+// Offered each ready request before dispatch, on the loop thread and in
+// blocking mode. Returns 1 if it answered the request and closed fd.
+typedef int (*inlineFunction)(int fd, httpRequest *req);
+
+void eventSetInlineHandler(inlineFunction handler);
+
+void eventLoopRun(EventLoop loop);
+
+// HTTP keep-alive: idle connections are parked back in their loop rather
+// than holding a worker. A timeout of 0 disables keep-alive.
+void eventSetKeepAlive(int timeoutSec, int maxRequests);
+
+// New connections that have not sent a complete request head this many
+// seconds after accept are closed. 0 disables the deadline.
+void eventSetHeaderTimeout(int timeoutSec);
+
+// Address of the client on the other end of fd
+struct in_addr eventPeerAddr(int fd);
+
+// The parsed head of fd's current request. Valid until eventPark(fd)
+// or close.
+httpRequest *eventRequest(int fd);
+
+// Arrival time of fd's current request on the monotonic metricsClock()
+long long eventArrivalClock(int fd);
+
+// When the loop finished reading fd's request head, on metricsClock()
+long long eventParsedClock(int fd);
+
+// 1 if the connection may be kept open after the current request
+int eventCanKeepAlive(int fd);
+
+// Hands a served connection back to its loop to wait for the next request
+void eventPark(int fd);
+
+#endif // __EVENT_H__
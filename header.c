@@ -0,0 +1,84 @@
+#include "segel.h"
+#include "header.h"
+#include <sys/uio.h>
+
+void headerInit(headerBuf *h)
+{
+    h->len = 0;
+}
+
+void headerAppend(headerBuf *h, const char *s, size_t n)
+{
+    if (n > HEADER_MAX - h->len) {
+        n = HEADER_MAX - h->len;
+    }
+    memcpy(h->data + h->len, s, n);
+    h->len += n;
+}
+
+void headerString(headerBuf *h, const char *s)
+{
+    headerAppend(h, s, strlen(s));
+}
+
+// Writes value in decimal so that it ends just before end, zero-padded
+// to at least width digits, and returns where it starts
+static char *formatNumber(char *end, unsigned long value, int width)
+{
+    char *p = end;
+    do {
+        *--p = '0' + value % 10;
+        value /= 10;
+        width--;
+    } while (value > 0 || width > 0);
+    return p;
+}
+
+void headerNumber(headerBuf *h, unsigned long value)
+{
+    char digits[24];
+    char *p = formatNumber(digits + sizeof(digits), value, 1);
+    headerAppend(h, p, digits + sizeof(digits) - p);
+}
+
+void headerTime(headerBuf *h, struct timeval tv)
+{
+    char digits[24];
+    headerNumber(h, tv.tv_sec);
+    headerLiteral(h, ".");
+    char *p = formatNumber(digits + sizeof(digits), tv.tv_usec, 6);
+    headerAppend(h, p, digits + sizeof(digits) - p);
+}
+
+int headerSend(int fd, headerBuf *h, const void *body, size_t len, int flags)
+{
+    struct iovec iov[2] = {
+        { h->data, h->len },
+        { (void *)body, len },
+    };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(fd, &msg, flags | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        // Skip what went out, which may end inside either part
+        while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef __HEADER_H__
+#define __HEADER_H__
+
+#include <stddef.h>
+#include <sys/time.h>
+
+// Response header block built in one pass. Every append knows where the
+// text ends, so nothing is rescanned with strlen or reparsed by sprintf.
+// Appends that would overflow are cut short; the block is never larger
+// than HEADER_MAX.
+
+#define HEADER_MAX 8192
+
+typedef struct headerBuf {
+    size_t len;
+    char data[HEADER_MAX];
+} headerBuf;
+
+void headerInit(headerBuf *h);
+
+void headerAppend(headerBuf *h, const char *s, size_t n);
+
+// String literals, with their length known at compile time
+#define headerLiteral(h, lit) headerAppend((h), (lit), sizeof(lit) - 1)
+
+void headerString(headerBuf *h, const char *s);
+
+void headerNumber(headerBuf *h, unsigned long value);
+
+// "sec.usec", usec zero-padded to six digits
+void headerTime(headerBuf *h, struct timeval tv);
+
+// Sends the header block and then body, if any, with a single sendmsg
+// (retried only for what a partial write left over). flags are added to
+// MSG_NOSIGNAL, so a client that hung up is an error, not a SIGPIPE.
+// Returns 0, or -1 if the connection failed.
+int headerSend(int fd, headerBuf *h, const void *body, size_t len, int flags);
+
+#endif // __HEADER_H__
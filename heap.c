@@ -0,0 +1,133 @@
+#include "heap.h"
+
+typedef struct heapEntry {
+    long long key;
+    Node node;
+} heapEntry;
+
+struct Heap {
+    heapEntry *entries;
+    int size;
+    int capacity;
+};
+
+Heap heapConstructor(int capacity)
+{
+    Heap heap = (Heap)malloc(sizeof(*heap));
+    if (heap == NULL) {
+        return NULL;
+    }
+    heap->entries = (heapEntry *)malloc(sizeof(heapEntry) * capacity);
+    if (heap->entries == NULL) {
+        free(heap);
+        return NULL;
+    }
+    heap->size = 0;
+    heap->capacity = capacity;
+    return heap;
+}
+
+static void siftUp(Heap heap, int i)
+{
+    heapEntry e = heap->entries[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (heap->entries[parent].key <= e.key) {
+            break;
+        }
+        heap->entries[i] = heap->entries[parent];
+        i = parent;
+    }
+    heap->entries[i] = e;
+}
+
+static void siftDown(Heap heap, int i)
+{
+    heapEntry e = heap->entries[i];
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= heap->size) {
+            break;
+        }
+        if (child + 1 < heap->size &&
+            heap->entries[child + 1].key < heap->entries[child].key) {
+            child++;
+        }
+        if (e.key <= heap->entries[child].key) {
+            break;
+        }
+        heap->entries[i] = heap->entries[child];
+        i = child;
+    }
+    heap->entries[i] = e;
+}
+
+// Takes out entry i, filling the hole with the last entry
+static Node removeAt(Heap heap, int i)
+{
+    Node node = heap->entries[i].node;
+    heap->size--;
+    if (i < heap->size) {
+        heap->entries[i] = heap->entries[heap->size];
+        siftDown(heap, i);
+        siftUp(heap, i);
+    }
+    return node;
+}
+
+int heapPush(Heap heap, Node node, long long key)
+{
+    if (heap->size == heap->capacity) {
+        return 0;
+    }
+    heap->entries[heap->size].key = key;
+    heap->entries[heap->size].node = node;
+    siftUp(heap, heap->size);
+    heap->size++;
+    return 1;
+}
+
+Node heapPop(Heap heap)
+{
+    return heap->size > 0 ? removeAt(heap, 0) : NULL;
+}
+
+int heapSize(Heap heap)
+{
+    return heap->size;
+}
+
+static int oldestIndex(Heap heap)
+{
+    int oldest = 0;
+    struct timeval best = getArrivalTime(heap->entries[0].node);
+    for (int i = 1; i < heap->size; i++) {
+        struct timeval t = getArrivalTime(heap->entries[i].node);
+        if (timercmp(&t, &best, <)) {
+            oldest = i;
+            best = t;
+        }
+    }
+    return oldest;
+}
+
+Node heapPeekOldest(Heap heap)
+{
+    return heap->size > 0 ? heap->entries[oldestIndex(heap)].node : NULL;
+}
+
+Node heapRemoveOldest(Heap heap)
+{
+    return heap->size > 0 ? removeAt(heap, oldestIndex(heap)) : NULL;
+}
+
+int heapRemoveRandom(Heap heap, int count, int *values)
+{
+    int removed = 0;
+    while (removed < count && heap->size > 0) {
+        Node node = removeAt(heap, rand() % heap->size);
+        values[removed++] = getValue(node);
+        nodeDestructor(node);
+    }
+    return removed;
+}
@@ -0,0 +1,31 @@
+#ifndef __HEAP_H__
+#define __HEAP_H__
+
+#include "queue.h"
+
+// Bounded binary min-heap of request nodes, ordered by a caller-supplied
+// key. Not thread safe; callers hold their own lock.
+
+typedef struct Heap *Heap;
+
+Heap heapConstructor(int capacity);
+
+// Returns 1 on success, 0 if the heap is full
+int heapPush(Heap heap, Node node, long long key);
+
+// The node with the smallest key, or NULL if the heap is empty
+Node heapPop(Heap heap);
+
+int heapSize(Heap heap);
+
+// The entry that arrived first, left in place (NULL if empty), and the
+// same entry removed. Both are O(size).
+Node heapPeekOldest(Heap heap);
+
+Node heapRemoveOldest(Heap heap);
+
+// Removes up to count random entries, storing their values in values[]
+// and returning their nodes to the pool. Returns how many were removed.
+int heapRemoveRandom(Heap heap, int count, int *values);
+
+#endif // __HEAP_H__
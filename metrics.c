@@ -0,0 +1,329 @@
+#include "segel.h"
+#include "metrics.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <poll.h>
+#include "request.h"
+#include "cache.h"
+#include "header.h"
+
+static threadStats *metric_threads = NULL;
+static int metric_thread_count = 0;
+static void (*metric_gauges)(metricsGauges *out) = NULL;
+static atomic_ulong drops[DROP_REASONS];
+
+static const char *drop_names[DROP_REASONS] = {
+    "tail", "head", "random", "flush", "codel", "ratelimit", "header_timeout"
+};
+
+static const char *phase_names[PHASES] = {
+    "accept", "queue", "parse", "lookup", "send", "cgi"
+};
+
+static const char *kind_names[KINDS] = { "static", "dynamic", "vip" };
+
+// Single-writer increment: a relaxed load and store, no lock prefix
+static inline void counterAdd(atomic_ulong *c, unsigned long n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+void histogramRecord(latencyHistogram *h, long long us)
+{
+    int i = 0;
+    while (i < HIST_BUCKETS - 1 && us > (1LL << i)) {
+        i++;
+    }
+    counterAdd(&h->count[i], 1);
+    counterAdd(&h->sum_us, us > 0 ? us : 0);
+}
+
+long long metricsClock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Values below 2 * PHASE_SUB get a bucket each. Above that the top
+// PHASE_SUB_BITS + 1 bits select the bucket and the rest are dropped.
+static int phaseBucket(long long us)
+{
+    if (us < 0) {
+        us = 0;
+    }
+    if (us >= (1LL << PHASE_MAX_BITS)) {
+        us = (1LL << PHASE_MAX_BITS) - 1;
+    }
+    if (us < 2 * PHASE_SUB) {
+        return (int)us;
+    }
+    int shift = 63 - __builtin_clzll(us) - PHASE_SUB_BITS;
+    return shift * PHASE_SUB + (int)(us >> shift);
+}
+
+// Largest value that lands in bucket i
+static long long phaseBucketTop(int i)
+{
+    if (i < 2 * PHASE_SUB) {
+        return i;
+    }
+    int shift = i / PHASE_SUB - 1;
+    long long low = (long long)(i - shift * PHASE_SUB) << shift;
+    return low + (1LL << shift) - 1;
+}
+
+void phaseStart(threadStats *t, long long accepted, long long parsed,
+                long long enqueued)
+{
+    phaseTimer *p = &t->phase;
+    p->kind = -1;
+    for (int i = 0; i < PHASES; i++) {
+        p->us[i] = -1;
+    }
+    p->mark = metricsClock();
+    p->us[PHASE_PARSE] = parsed - accepted;
+    p->us[PHASE_ACCEPT] = enqueued - parsed;
+    p->us[PHASE_QUEUE] = p->mark - enqueued;
+}
+
+void phaseMark(threadStats *t, int phase)
+{
+    long long now = metricsClock();
+    t->phase.us[phase] = now - t->phase.mark;
+    t->phase.mark = now;
+}
+
+void phaseCommit(threadStats *t)
+{
+    phaseTimer *p = &t->phase;
+    if (p->kind < 0) {
+        return;
+    }
+    for (int i = 0; i < PHASES; i++) {
+        if (p->us[i] >= 0) {
+            phaseHistogram *h = &t->phases[p->kind][i];
+            counterAdd(&h->count[phaseBucket(p->us[i])], 1);
+            counterAdd(&h->sum_us, p->us[i]);
+        }
+    }
+    p->kind = -1;
+}
+
+void metricsCountDrop(int reason, int count)
+{
+    atomic_fetch_add_explicit(&drops[reason], count, memory_order_relaxed);
+}
+
+void metricsInit(threadStats *threads, int count, void (*gauges)(metricsGauges *out))
+{
+    metric_threads = threads;
+    metric_thread_count = count;
+    metric_gauges = gauges;
+}
+
+// Growable text buffer for the response body
+typedef struct textBuf {
+    char *data;
+    size_t len;
+    size_t cap;
+} textBuf;
+
+static void appendf(textBuf *b, const char *fmt, ...)
+{
+    while (1) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            return;
+        }
+        if (b->len + n < b->cap) {
+            b->len += n;
+            return;
+        }
+        b->cap = 2 * (b->cap + n);
+        b->data = (char *)realloc(b->data, b->cap);
+        if (b->data == NULL) {
+            unix_error("realloc error");
+        }
+    }
+}
+
+static unsigned long load(atomic_ulong *c)
+{
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+static void appendHistogram(textBuf *b, const char *name, const char *help,
+                            size_t offset)
+{
+    unsigned long count[HIST_BUCKETS] = { 0 };
+    unsigned long sum = 0;
+    for (int t = 0; t < metric_thread_count; t++) {
+        latencyHistogram *h = (latencyHistogram *)((char *)&metric_threads[t] + offset);
+        for (int i = 0; i < HIST_BUCKETS; i++) {
+            count[i] += load(&h->count[i]);
+        }
+        sum += load(&h->sum_us);
+    }
+
+    appendf(b, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    unsigned long cumulative = 0;
+    for (int i = 0; i < HIST_BUCKETS - 1; i++) {
+        cumulative += count[i];
+        appendf(b, "%s_bucket{le=\"%.6f\"} %lu\n", name, (double)(1LL << i) / 1e6, cumulative);
+    }
+    cumulative += count[HIST_BUCKETS - 1];
+    appendf(b, "%s_bucket{le=\"+Inf\"} %lu\n", name, cumulative);
+    appendf(b, "%s_sum %.6f\n%s_count %lu\n", name, sum / 1e6, name, cumulative);
+}
+
+// Merges one phase of one kind over all threads into p50/p99/p999
+static void appendPhase(textBuf *b, const char *name, int kind, int phase)
+{
+    static const double quantiles[] = { 0.5, 0.99, 0.999 };
+    unsigned long count[PHASE_BUCKETS] = { 0 };
+    unsigned long total = 0, sum = 0;
+    for (int t = 0; t < metric_thread_count; t++) {
+        phaseHistogram *h = &metric_threads[t].phases[kind][phase];
+        for (int i = 0; i < PHASE_BUCKETS; i++) {
+            unsigned long c = load(&h->count[i]);
+            count[i] += c;
+            total += c;
+        }
+        sum += load(&h->sum_us);
+    }
+    if (total == 0) {
+        return;
+    }
+
+    const char *labels = "class=\"%s\",phase=\"%s\"";
+    char label[64];
+    snprintf(label, sizeof(label), labels, kind_names[kind], phase_names[phase]);
+    int i = 0;
+    unsigned long seen = count[0];
+    for (int q = 0; q < 3; q++) {
+        unsigned long rank = (unsigned long)(quantiles[q] * total + 0.999999);
+        while (seen < rank && i < PHASE_BUCKETS - 1) {
+            seen += count[++i];
+        }
+        appendf(b, "%s{%s,quantile=\"%g\"} %.6f\n", name, label, quantiles[q],
+                phaseBucketTop(i) / 1e6);
+    }
+    appendf(b, "%s_sum{%s} %.6f\n%s_count{%s} %lu\n", name, label, sum / 1e6,
+            name, label, total);
+}
+
+static void metricsRender(textBuf *b)
+{
+    metricsGauges g = { 0, 0, 0 };
+    if (metric_gauges != NULL) {
+        metric_gauges(&g);
+    }
+    appendf(b, "# HELP server_queue_requests Requests currently in each queue.\n");
+    appendf(b, "# TYPE server_queue_requests gauge\n");
+    appendf(b, "server_queue_requests{queue=\"vip\"} %d\n", g.vip);
+    appendf(b, "server_queue_requests{queue=\"waiting\"} %d\n", g.waiting);
+    appendf(b, "server_queue_requests{queue=\"running\"} %d\n", g.running);
+
+    appendf(b, "# HELP server_dropped_requests_total Requests dropped instead of served.\n");
+    appendf(b, "# TYPE server_dropped_requests_total counter\n");
+    for (int i = 0; i < DROP_REASONS; i++) {
+        appendf(b, "server_dropped_requests_total{reason=\"%s\"} %lu\n",
+                drop_names[i], load(&drops[i]));
+    }
+
+    appendf(b, "# HELP server_thread_requests_total Requests handled per worker thread.\n");
+    appendf(b, "# TYPE server_thread_requests_total counter\n");
+    for (int t = 0; t < metric_thread_count; t++) {
+        threadStats *s = &metric_threads[t];
+        appendf(b, "server_thread_requests_total{thread=\"%d\",kind=\"static\"} %d\n",
+                s->id, s->stat_req);
+        appendf(b, "server_thread_requests_total{thread=\"%d\",kind=\"dynamic\"} %d\n",
+                s->id, s->dynm_req);
+        appendf(b, "server_thread_requests_total{thread=\"%d\",kind=\"all\"} %d\n",
+                s->id, s->total_req);
+    }
+
+    appendHistogram(b, "server_request_duration_seconds",
+                    "Time from arrival to the end of the response.",
+                    offsetof(threadStats, latency));
+
+    appendf(b, "# HELP server_phase_seconds Time spent in each phase of a request.\n");
+    appendf(b, "# TYPE server_phase_seconds summary\n");
+    for (int k = 0; k < KINDS; k++) {
+        for (int p = 0; p < PHASES; p++) {
+            appendPhase(b, "server_phase_seconds", k, p);
+        }
+    }
+
+    cacheStats cs;
+    cacheGetStats(&cs);
+    appendf(b, "# TYPE server_cache_hits_total counter\nserver_cache_hits_total %lu\n", cs.hits);
+    appendf(b, "# TYPE server_cache_misses_total counter\nserver_cache_misses_total %lu\n", cs.misses);
+    appendf(b, "# TYPE server_cache_evictions_total counter\nserver_cache_evictions_total %lu\n", cs.evictions);
+    appendf(b, "# TYPE server_cache_bytes gauge\nserver_cache_bytes %zu\n", cs.bytes);
+    appendf(b, "# TYPE server_cache_entries gauge\nserver_cache_entries %d\n", cs.entries);
+}
+
+int metricsWanted(struct httpRequest *req)
+{
+    return req->status == 0 && parserSliceIs(req->method, "GET") &&
+           req->uri.len == 8 && !memcmp(req->uri.ptr, "/metrics", 8);
+}
+
+// Writes without blocking past deadline (metricsClock time). Returns -1
+// if the peer is gone or has not taken everything by then.
+static int sendBefore(int fd, const char *data, size_t len, int flags, long long deadline)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0) {
+            data += n;
+            len -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        long long left = (deadline - metricsClock()) / 1000;
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || left <= 0) {
+            return -1;
+        }
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, (int)left) < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void metricsServe(int fd)
+{
+    textBuf body = { (char *)malloc(8192), 0, 8192 };
+    if (body.data == NULL) {
+        unix_error("malloc error");
+    }
+    metricsRender(&body);
+
+    headerBuf h;
+    headerInit(&h);
+    headerLiteral(&h, "HTTP/1.0 200 OK\r\n"
+                      "Server: OS-HW3 Web Server\r\n"
+                      "Content-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: ");
+    headerNumber(&h, body.len);
+    headerLiteral(&h, "\r\n\r\n");
+    // This runs on the event loop, so a scraper that does not read is
+    // given a bounded time and then cut off. One that hung up is not
+    // our problem either.
+    long long deadline = metricsClock() + METRICS_SEND_TIMEOUT_US;
+    if (sendBefore(fd, h.data, h.len, MSG_MORE, deadline) == 0) {
+        sendBefore(fd, body.data, body.len, 0, deadline);
+    }
+    free(body.data);
+    Close(fd);
+}
@@ -0,0 +1,114 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdatomic.h>
+
+// Counters behind the built-in /metrics endpoint (Prometheus text format).
+//
+// Per-thread values live in the thread's own threadStats, which is
+// padded to a cache line, and have a single writer. Updating them is a
+// plain load and store, never a locked instruction, and the endpoint
+// sums them when scraped.
+
+// Latency histogram with power-of-two microsecond buckets: bucket i
+// counts values up to 2^i us, the last one everything above.
+#define HIST_BUCKETS 24
+
+typedef struct latencyHistogram {
+    atomic_ulong count[HIST_BUCKETS];
+    atomic_ulong sum_us;
+} latencyHistogram;
+
+// Only the owning thread may record into h
+void histogramRecord(latencyHistogram *h, long long us);
+
+// Per-phase latencies use HDR-style log-linear buckets instead: every
+// power of two is split into PHASE_SUB linear sub-buckets, so a bucket is
+// never wider than 1/16 of its values (exact below 32 us), up to 2^32 us.
+#define PHASE_SUB_BITS  4
+#define PHASE_SUB       (1 << PHASE_SUB_BITS)
+#define PHASE_MAX_BITS  32
+#define PHASE_BUCKETS   ((PHASE_MAX_BITS - PHASE_SUB_BITS + 1) * PHASE_SUB)
+
+typedef struct phaseHistogram {
+    atomic_ulong count[PHASE_BUCKETS];
+    atomic_ulong sum_us;
+} phaseHistogram;
+
+// What a request spends its time on. In order: parse, accept, queue,
+// then lookup and send or cgi.
+#define PHASE_ACCEPT    0   // head parsed to enqueued (classification, admission)
+#define PHASE_QUEUE     1   // waiting for a worker
+#define PHASE_PARSE     2   // accepted (or first bytes after keep-alive) to
+                            // the head read and parsed by the event loop
+#define PHASE_LOOKUP    3   // finding the file (stat)
+#define PHASE_SEND      4   // sending a static response
+#define PHASE_CGI       5   // running the CGI program
+#define PHASES          6
+
+// Request classes the phases are broken down by
+#define KIND_STATIC     0
+#define KIND_DYNAMIC    1
+#define KIND_VIP        2
+#define KINDS           3
+
+// The phases of the request a worker is handling, kept until it is known
+// which kind of request it was
+typedef struct phaseTimer {
+    int kind;               // KIND_*, -1 until classified
+    long long mark;         // end of the last phase
+    long long us[PHASES];   // -1 for phases the request skipped
+} phaseTimer;
+
+// Monotonic clock in microseconds; unlike gettimeofday it never jumps
+long long metricsClock(void);
+
+struct threadStats;
+
+// Starts timing a request a worker just took: accepted, parsed and
+// enqueued are metricsClock() stamps, the queue phase ends now
+void phaseStart(struct threadStats *t, long long accepted, long long parsed,
+                long long enqueued);
+
+// Ends phase at the current time, it began where the last one ended
+void phaseMark(struct threadStats *t, int phase);
+
+// Adds the finished request's phases to the thread's histograms
+void phaseCommit(struct threadStats *t);
+
+// Why a request was dropped instead of served
+#define DROP_TAIL       0   // new request refused (dt, codel on a full queue)
+#define DROP_HEAD       1   // oldest waiting request (dh)
+#define DROP_RANDOM     2   // random waiting requests (random)
+#define DROP_FLUSH      3   // new request after a flush (bf)
+#define DROP_CODEL      4   // waited too long (codel)
+#define DROP_RATELIMIT  5   // client over its rate
+#define DROP_TIMEOUT    6   // no complete request head in time
+#define DROP_REASONS    7
+
+void metricsCountDrop(int reason, int count);
+
+// Queue sizes at the moment of the scrape, filled in by the scheduler
+typedef struct metricsGauges {
+    int vip;
+    int waiting;
+    int running;
+} metricsGauges;
+
+// Registers the threads to report and where current queue sizes come from
+void metricsInit(struct threadStats *threads, int count,
+                 void (*gauges)(metricsGauges *out));
+
+struct httpRequest;
+
+// Longest the event loop spends writing one /metrics response
+#define METRICS_SEND_TIMEOUT_US 200000
+
+// Whether req is "GET /metrics"
+int metricsWanted(struct httpRequest *req);
+
+// Answers a /metrics request and closes fd. The whole head has been
+// read, so nothing is left to consume.
+void metricsServe(int fd);
+
+#endif // __METRICS_H__
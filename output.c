@@ -1,4 +1,5 @@
 #include "segel.h"
+#include "cgiproto.h"
 #include <sys/time.h>
 #include <assert.h>
 #include <unistd.h>
@@ -34,7 +35,8 @@ double Time_GetSeconds() {
 }
 
 
-int main(int argc, char *argv[])
+// Writes one response to stdout
+void serve()
 {
   char content[MAXBUF];
 
@@ -54,7 +56,78 @@ int main(int argc, char *argv[])
   printf("Content-type: text/html\r\n\r\n");
   printf("%s", content);
   fflush(stdout);
+}
+
+// Reads one frame from the server on stdin; a passed descriptor, if any,
+// lands in *passfd. Returns -1 once the server has gone away.
+int readFrame(cgiFrameHeader *hdr, char *payload, int *passfd)
+{
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { hdr, sizeof(*hdr) };
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if (recvmsg(STDIN_FILENO, &msg, MSG_WAITALL) != sizeof(*hdr))
+    return -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg != NULL && cmsg->cmsg_type == SCM_RIGHTS)
+    memcpy(passfd, CMSG_DATA(cmsg), sizeof(int));
+  if (hdr->version != CGI_FRAME_VERSION || hdr->length >= MAXBUF)
+    return -1;
+  if (rio_readn(STDIN_FILENO, payload, hdr->length) != hdr->length)
+    return -1;
+  payload[hdr->length] = '\0';
+  return 0;
+}
+
+// Pooled mode: serve requests from the server until it closes our socket
+void servePool()
+{
+  cgiFrameHeader hdr;
+  char payload[MAXBUF];
+  int clientfd = -1;
+  int devnull = open("/dev/null", O_WRONLY);
 
+  // A client hanging up must not take the process down with it
+  signal(SIGPIPE, SIG_IGN);
+
+  while (readFrame(&hdr, payload, &clientfd) == 0) {
+    if (hdr.type == CGI_PARAMS && clientfd >= 0) {
+      for (char *p = payload; p < payload + hdr.length; p += strlen(p) + 1) {
+        char *eq = strchr(p, '=');
+        if (eq != NULL) {
+          *eq = '\0';
+          setenv(p, eq + 1, 1);
+        }
+      }
+      spinfor = 5.0;
+      dup2(clientfd, STDOUT_FILENO);
+      serve();
+      dup2(devnull, STDOUT_FILENO);
+      close(clientfd);
+      clientfd = -1;
+
+      int status = 0;
+      cgiFrameHeader end = { CGI_FRAME_VERSION, CGI_END, hdr.requestId, sizeof(status) };
+      char reply[sizeof(end) + sizeof(status)];
+      memcpy(reply, &end, sizeof(end));
+      memcpy(reply + sizeof(end), &status, sizeof(status));
+      if (rio_writen(STDIN_FILENO, reply, sizeof(reply)) != sizeof(reply))
+        break;
+    }
+  }
   exit(0);
 }
 
+int main(int argc, char *argv[])
+{
+  if (argc > 1 && strcmp(argv[1], CGI_POOL_ARG) == 0)
+    servePool();
+
+  serve();
+  exit(0);
+}
@@ -0,0 +1,235 @@
+#include "segel.h"
+#include "parser.h"
+
+#define STATE_REQUEST_LINE  0
+#define STATE_HEADERS       1
+#define STATE_DONE          2
+
+void parserInit(httpRequest *r)
+{
+    memset(r, 0, offsetof(httpRequest, buf));
+    r->state = STATE_REQUEST_LINE;
+    r->buf[0] = '\0';
+}
+
+static int parserFail(httpRequest *r, int status)
+{
+    r->status = status;
+    r->state = STATE_DONE;
+    r->headLen = r->len;
+    return PARSER_DONE;
+}
+
+static int isBlank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+// Next run of non-blanks in [*p, end), or an empty slice
+static httpSlice nextToken(const char **p, const char *end)
+{
+    while (*p < end && isBlank(**p)) {
+        (*p)++;
+    }
+    httpSlice s = { *p, 0 };
+    while (*p < end && !isBlank(**p)) {
+        (*p)++;
+    }
+    s.len = *p - s.ptr;
+    return s;
+}
+
+// "METHOD URI [VERSION]", as sscanf("%s %s %s") used to accept it
+static int parseRequestLine(httpRequest *r, const char *line, int n)
+{
+    const char *p = line, *end = line + n;
+    r->method = nextToken(&p, end);
+    r->uri = nextToken(&p, end);
+    r->version = nextToken(&p, end);
+    httpSlice extra = nextToken(&p, end);
+    return (r->uri.len == 0 || extra.len != 0) ? -1 : 0;
+}
+
+// Splits "Name: value" with the value trimmed
+static int splitHeader(const char *line, int n, httpSlice *name, httpSlice *value)
+{
+    const char *colon = memchr(line, ':', n);
+    if (colon == NULL || colon == line) {
+        return -1;
+    }
+    name->ptr = line;
+    name->len = colon - line;
+
+    const char *v = colon + 1, *end = line + n;
+    while (v < end && isBlank(*v)) {
+        v++;
+    }
+    while (end > v && isBlank(end[-1])) {
+        end--;
+    }
+    value->ptr = v;
+    value->len = end - v;
+    return 0;
+}
+
+int parserRun(httpRequest *r)
+{
+    while (r->state != STATE_DONE) {
+        char *nl = memchr(r->buf + r->pos, '\n', r->len - r->pos);
+        if (nl == NULL) {
+            r->pos = r->len;
+            if (r->state == STATE_REQUEST_LINE &&
+                (r->len - r->lineStart > PARSER_MAX_LINE || r->len >= PARSER_MAX_HEAD)) {
+                return parserFail(r, 414);
+            }
+            if (r->len >= PARSER_MAX_HEAD) {
+                return parserFail(r, 431);
+            }
+            return PARSER_MORE;
+        }
+
+        const char *line = r->buf + r->lineStart;
+        int n = nl - line;
+        if (n > 0 && line[n - 1] == '\r') {
+            n--;
+        }
+        r->pos = nl + 1 - r->buf;
+
+        if (r->state == STATE_REQUEST_LINE) {
+            // Empty lines ahead of a request are allowed and skipped
+            if (n > 0) {
+                if (n > PARSER_MAX_LINE) {
+                    return parserFail(r, 414);
+                }
+                if (parseRequestLine(r, line, n) < 0) {
+                    return parserFail(r, 400);
+                }
+                r->state = STATE_HEADERS;
+                r->headers.ptr = r->buf + r->pos;
+            }
+        } else if (n == 0) {
+            r->headers.len = line - r->headers.ptr;
+            r->headLen = r->pos;
+            r->state = STATE_DONE;
+        } else {
+            httpSlice name, value;
+            if (++r->headerCount > PARSER_MAX_HEADERS) {
+                return parserFail(r, 431);
+            }
+            if (splitHeader(line, n, &name, &value) < 0) {
+                return parserFail(r, 400);
+            }
+            if (parserSliceIs(name, "Connection")) {
+                r->connection = value;
+            } else if (parserSliceIs(name, "Accept-Encoding")) {
+                r->acceptEncoding = value;
+            }
+        }
+        r->lineStart = r->pos;
+    }
+    return PARSER_DONE;
+}
+
+int parserRead(httpRequest *r, int fd)
+{
+    while (r->state != STATE_DONE) {
+        // parserRun fails a head that fills buf, so there is always room
+        ssize_t n = recv(fd, r->buf + r->len, PARSER_MAX_HEAD - r->len, 0);
+        if (n == 0) {
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? PARSER_MORE : -1;
+        }
+        r->len += n;
+        r->buf[r->len] = '\0';
+        parserRun(r);
+    }
+    return PARSER_DONE;
+}
+
+int parserNextHeader(httpRequest *r, int *pos, httpSlice *name, httpSlice *value)
+{
+    while (*pos < r->headers.len) {
+        const char *line = r->headers.ptr + *pos;
+        const char *nl = memchr(line, '\n', r->headers.len - *pos);
+        int n = nl - line;
+        *pos += n + 1;
+        if (n > 0 && line[n - 1] == '\r') {
+            n--;
+        }
+        if (splitHeader(line, n, name, value) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int parserSliceIs(httpSlice s, const char *str)
+{
+    return (int)strlen(str) == s.len && !strncasecmp(s.ptr, str, s.len);
+}
+
+int parserSliceHas(httpSlice s, const char *str)
+{
+    int n = strlen(str);
+    for (int i = 0; i + n <= s.len; i++) {
+        if (!strncasecmp(s.ptr + i, str, n)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether the parameters of a list element, e.g. ";q=0.5", leave q > 0
+static int qualityNonZero(const char *p, const char *end)
+{
+    while (p < end) {
+        while (p < end && (*p == ';' || isBlank(*p))) {
+            p++;
+        }
+        if (end - p >= 2 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+            for (p += 2; p < end && *p != ';'; p++) {
+                if (*p >= '1' && *p <= '9') {
+                    return 1;
+                }
+            }
+            return 0;
+        }
+        while (p < end && *p != ';') {
+            p++;
+        }
+    }
+    return 1;
+}
+
+int parserListAccepts(httpSlice s, const char *token)
+{
+    int named = -1, star = -1;
+    const char *p = s.ptr, *end = s.ptr + s.len;
+    while (p < end) {
+        const char *next = memchr(p, ',', end - p);
+        const char *elemEnd = next != NULL ? next : end;
+
+        const char *params = memchr(p, ';', elemEnd - p);
+        httpSlice name = nextToken(&p, params != NULL ? params : elemEnd);
+        int ok = qualityNonZero(params != NULL ? params : elemEnd, elemEnd);
+        if (parserSliceIs(name, token)) {
+            named = ok;
+        } else if (parserSliceIs(name, "*")) {
+            star = ok;
+        }
+        p = next != NULL ? next + 1 : end;
+    }
+    return named >= 0 ? named : star > 0;
+}
+
+void parserSliceCopy(httpSlice s, char *dst, size_t size)
+{
+    size_t n = (size_t)s.len < size - 1 ? (size_t)s.len : size - 1;
+    memcpy(dst, s.ptr, n);
+    dst[n] = '\0';
+}
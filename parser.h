@@ -0,0 +1,67 @@
+#ifndef __PARSER_H__
+#define __PARSER_H__
+
+#include <stddef.h>
+
+// Incremental HTTP request head parser. Bytes are appended to the
+// request's own buffer as they arrive and parserRun resumes where it
+// stopped, so a head split over any number of reads is scanned once.
+// Nothing is allocated or copied: the parts we use are slices of buf.
+
+#define PARSER_MAX_HEAD     8192    // request line and headers; 431 beyond
+#define PARSER_MAX_LINE     4096    // request line alone; 414 beyond
+#define PARSER_MAX_HEADERS  100     // header lines; 431 beyond
+
+#define PARSER_MORE     0           // head incomplete, read more
+#define PARSER_DONE     1           // head complete, or status set
+
+typedef struct httpSlice {
+    const char *ptr;
+    int len;
+} httpSlice;
+
+typedef struct httpRequest {
+    httpSlice method;
+    httpSlice uri;
+    httpSlice version;          // empty for a bare "GET /uri"
+    httpSlice connection;       // value of the Connection header
+    httpSlice acceptEncoding;   // value of the Accept-Encoding header
+    httpSlice headers;          // all header lines, line ends included
+    int status;                 // 0, or the error to answer: 400, 414, 431
+    int headLen;                // bytes of buf up to the end of the head
+
+    // Where parsing resumes
+    int state;
+    int pos;
+    int lineStart;
+    int headerCount;
+
+    int len;                    // bytes in buf, which stays NUL-terminated
+    char buf[PARSER_MAX_HEAD + 1];
+} httpRequest;
+
+void parserInit(httpRequest *r);
+
+// Parses what was appended to buf since the last call. Returns
+// PARSER_DONE once the head is complete or known to be invalid.
+int parserRun(httpRequest *r);
+
+// Reads what the non-blocking fd has to offer into buf and parses it.
+// Returns PARSER_DONE, PARSER_MORE, or -1 if the peer went away first.
+int parserRead(httpRequest *r, int fd);
+
+// Walks the header lines; start with *pos = 0. Returns 0 after the last.
+int parserNextHeader(httpRequest *r, int *pos, httpSlice *name, httpSlice *value);
+
+// Case-insensitive: s equals str, s contains str
+int parserSliceIs(httpSlice s, const char *str);
+int parserSliceHas(httpSlice s, const char *str);
+
+// 1 if the comma separated list s (e.g. an Accept-Encoding value) names
+// token, or failing that "*", without q=0
+int parserListAccepts(httpSlice s, const char *token);
+
+// Copies s into dst as a C string, truncated to fit size bytes
+void parserSliceCopy(httpSlice s, char *dst, size_t size);
+
+#endif // __PARSER_H__
@@ -4,15 +4,85 @@ struct List {
     int size;
     struct Node *head;
     struct Node *tail;
+
+    // Array-backed lists (queueConstructorArray) keep node pointers in a
+    // ring instead of linking them. Removed entries become NULL tombstones
+    // that are skipped at the front and squeezed out once they outnumber
+    // live entries, so at least half of [first, first + span) is live.
+    struct Node **slots;
+    int capacity;
+    int first;      // ring index of the oldest slot
+    int span;       // slots in use, tombstones included
 };
 struct Node {
     int value;
     int handlerThread;
     struct timeval arrival_time;
     struct timeval dispatch_time;
+    long long enqueue_time;     // monotonic us
     struct Node *next;
+    struct Node *prev;
+    int slot;       // ring index while in an array-backed list
+    bool pooled;
 };
 
+// Preallocated nodes, handed out LIFO through an intrusive free list.
+// Guarded by a spinlock of its own so acquire/release never sleep or
+// call into the allocator; malloc is only a fallback when it runs dry.
+static struct Node *pool_nodes = NULL;
+static struct Node *pool_free = NULL;
+static pthread_spinlock_t pool_lock;
+
+int queuePoolInit(int capacity) {
+    pthread_spin_init(&pool_lock, PTHREAD_PROCESS_PRIVATE);
+    pool_nodes = (struct Node *) calloc(capacity, sizeof(*pool_nodes));
+    if (pool_nodes == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < capacity; i++) {
+        pool_nodes[i].pooled = true;
+        pool_nodes[i].next = (i + 1 < capacity) ? &pool_nodes[i + 1] : NULL;
+    }
+    pool_free = pool_nodes;
+    return 1;
+}
+
+static long long monotonicMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static Node nodeAcquire() {
+    pthread_spin_lock(&pool_lock);
+    Node node = pool_free;
+    if (node != NULL) {
+        pool_free = node->next;
+    }
+    pthread_spin_unlock(&pool_lock);
+    if (node == NULL) {
+        node = (Node) malloc(sizeof(*node));
+        if (node != NULL) {
+            node->pooled = false;
+        }
+    }
+    return node;
+}
+
+void nodeDestructor(Node node) {
+    if (node == NULL) {
+        return;
+    }
+    if (!node->pooled) {
+        free(node);
+        return;
+    }
+    pthread_spin_lock(&pool_lock);
+    node->next = pool_free;
+    pool_free = node;
+    pthread_spin_unlock(&pool_lock);
+}
+
 List queueConstructor() {
     List list = (List) malloc(sizeof(*list));
     if (list == NULL) {
@@ -21,17 +91,93 @@ List queueConstructor() {
     list->size = 0;
     list->head = NULL;
     list->tail = NULL;
+    list->slots = NULL;
+    list->capacity = 0;
+    list->first = 0;
+    list->span = 0;
     return list;
 }
 
+List queueConstructorArray(int capacity) {
+    List list = queueConstructor();
+    if (list == NULL) {
+        return NULL;
+    }
+    list->capacity = capacity > 0 ? capacity : 1;
+    list->slots = (struct Node **) calloc(list->capacity, sizeof(*list->slots));
+    if (list->slots == NULL) {
+        free(list);
+        return NULL;
+    }
+    return list;
+}
+
+#define SLOT(list, i) ((list)->slots[((list)->first + (i)) % (list)->capacity])
+
+// Squeezes tombstones out of the ring, preserving order
+static void compactSlots(List list) {
+    int w = 0;
+    for (int r = 0; r < list->span; r++) {
+        Node node = SLOT(list, r);
+        if (node != NULL) {
+            SLOT(list, w) = node;
+            node->slot = (list->first + w) % list->capacity;
+            w++;
+        }
+    }
+    for (int r = w; r < list->span; r++) {
+        SLOT(list, r) = NULL;
+    }
+    list->span = w;
+}
+
+// Drops tombstones at both ends so the oldest slot is always live
+static void trimSlots(List list) {
+    while (list->span > 0 && SLOT(list, 0) == NULL) {
+        list->first = (list->first + 1) % list->capacity;
+        list->span--;
+    }
+    while (list->span > 0 && SLOT(list, list->span - 1) == NULL) {
+        list->span--;
+    }
+}
+
+// Makes room for one more slot at the tail
+static int reserveSlot(List list) {
+    if (list->span < list->capacity) {
+        return 1;
+    }
+    if (list->size < list->span) {
+        compactSlots(list);
+        return 1;
+    }
+    // Full of live entries: only here can an append allocate
+    int capacity = list->capacity * 2;
+    struct Node **slots = (struct Node **) calloc(capacity, sizeof(*slots));
+    if (slots == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < list->span; i++) {
+        slots[i] = SLOT(list, i);
+        slots[i]->slot = i;
+    }
+    free(list->slots);
+    list->slots = slots;
+    list->capacity = capacity;
+    list->first = 0;
+    return 1;
+}
+
 Node nodeConstructor(int value1, struct timeval arrivalTime) {
-    Node node = (Node) malloc(sizeof(*node));
+    Node node = nodeAcquire();
     if (node == NULL) {
         return NULL;
     }
     node->value = value1;
     node->arrival_time = arrivalTime;
+    node->enqueue_time = monotonicMicros();
     node->next = NULL;
+    node->prev = NULL;
     return node;
 }
 
@@ -39,17 +185,75 @@ int queueDestructor(List list) {
     if (list == NULL) {
         return -1;
     }
+    if (list->slots != NULL) {
+        for (int i = 0; i < list->span; i++) {
+            nodeDestructor(SLOT(list, i));
+        }
+        free(list->slots);
+        free(list);
+        return 1;
+    }
     Node node = list->head;
     while (node != NULL) {
         Node delete = node;
         node = node->next;
         delete->next = NULL;
-        free(delete);
+        nodeDestructor(delete);
     }
     free(list);
     return 1;
 }
 
+// Links node in at the tail
+static int linkTail(List list, Node node) {
+    if (list->slots != NULL) {
+        if (!reserveSlot(list)) {
+            return 0;
+        }
+        node->slot = (list->first + list->span) % list->capacity;
+        list->slots[node->slot] = node;
+        list->span++;
+        list->size++;
+        return 1;
+    }
+    node->next = NULL;
+    node->prev = list->tail;
+    if (list->size == 0) {
+        list->head = node;
+    } else {
+        list->tail->next = node;
+    }
+    list->tail = node;
+    list->size++;
+    return 1;
+}
+
+// Unlinks node from wherever it sits, in O(1) thanks to the back pointer
+static void unlinkNode(List list, Node node) {
+    if (list->slots != NULL) {
+        list->slots[node->slot] = NULL;
+        list->size--;
+        trimSlots(list);
+        if (list->span - list->size > list->size) {
+            compactSlots(list);
+        }
+        return;
+    }
+    if (node->prev != NULL) {
+        node->prev->next = node->next;
+    } else {
+        list->head = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
+    } else {
+        list->tail = node->prev;
+    }
+    node->next = NULL;
+    node->prev = NULL;
+    list->size--;
+}
+
 int appendNewRequest(List list, int value1, struct timeval arrivalTime) {
     if (list == NULL) {
         return -1;
@@ -58,16 +262,10 @@ int appendNewRequest(List list, int value1, struct timeval arrivalTime) {
     if (to_add == NULL) {
         return -1;
     }
-    if (list->size == 0) {
-        list->head = to_add;
-        list->tail = to_add;
-        list->size++;
-    } else {
-        list->tail->next = to_add;
-        list->tail = to_add;
-        list->size++;
+    if (!linkTail(list, to_add)) {
+        nodeDestructor(to_add);
+        return -1;
     }
-
     return 1;
 }
 
@@ -78,22 +276,15 @@ int append(List list, Node node, int threadId) {
     if (node == NULL) {
         return -1;
     }
+    dispatchNode(node, threadId);
+    return linkTail(list, node) ? 1 : -1;
+}
+
+void dispatchNode(Node node, int threadId) {
     struct timeval time;
     gettimeofday(&time, NULL);
-    if (list->size == 0) {
-        list->head = node;
-        list->tail = node;
-        timersub(&time, &node->arrival_time, &node->dispatch_time);
-        node->handlerThread = threadId;
-        list->size++;
-    } else {
-        list->tail->next = node;
-        list->tail = node;
-        timersub(&time, &node->arrival_time, &node->dispatch_time);
-        node->handlerThread = threadId;
-        list->size++;
-    }
-    return 1;
+    timersub(&time, &node->arrival_time, &node->dispatch_time);
+    node->handlerThread = threadId;
 }
 
 Node removeFront(List list) {
@@ -103,81 +294,68 @@ Node removeFront(List list) {
     if (list->size == 0) {
         return NULL;
     }
-    if (list->size == 1) {
-        Node toDelete = list->head;
-        list->head = NULL;
-        list->tail = NULL;
-        list->size--;
-        toDelete->next = NULL;
-        return toDelete;
-    } else {
-        Node toDelete = list->head;
-        Node next_head = toDelete->next;
-        list->head = next_head;
-        list->size--;
-        toDelete->next = NULL;
-        return toDelete;
+    Node toDelete = (list->slots != NULL) ? SLOT(list, 0) : list->head;
+    unlinkNode(list, toDelete);
+    return toDelete;
+}
 
+Node peekFront(List list) {
+    if (list == NULL || list->size == 0) {
+        return NULL;
     }
+    return (list->slots != NULL) ? SLOT(list, 0) : list->head;
 }
 
 int getSize(List list) {
     return list->size;
 }
 
+int removeNode(List list, Node node) {
+    if (list == NULL || node == NULL) {
+        return -1;
+    }
+    int toReturn = node->value;
+    unlinkNode(list, node);
+    nodeDestructor(node);
+    return toReturn;
+}
+
 int removeByValue(List list, int value1) {
     if (list == NULL) {
         return 0;
     }
-    Node temp = list->head;
-    if (temp->value == value1) {
-        if (list->size == 1) {
-            list->head = NULL;
-            list->tail = NULL;
-            int toReturn = temp->value;
-            free(temp);
-            list->size--;
-            return toReturn;
+    if (list->slots != NULL) {
+        for (int i = 0; i < list->span; i++) {
+            Node node = SLOT(list, i);
+            if (node != NULL && node->value == value1) {
+                return removeNode(list, node);
+            }
         }
-        list->head = temp->next;
-        int toReturn = temp->value;
-        free(temp);
-        list->size--;
-        return toReturn;
-    } // not in the beginning
+        return -1;
+    }
+    Node temp = list->head;
     while (temp != NULL) {
         if (temp->value == value1) {
-            break;
+            return removeNode(list, temp);
         }
         temp = temp->next;
     }
-    if (temp == NULL) {
-        return -1;
-    }
-    Node delete = list->head;
-    while (delete->next != temp) {
-        delete = delete->next;
-    }
-    if (temp->next == NULL) {//temp is in tail
-        delete->next = NULL;
-        list->tail = delete;
-        int toReturn = temp->value;
-        list->size--;
-        free(temp);
-        return toReturn;
-    }
-    delete->next = delete->next->next;
-    temp->next = NULL;
-    int toReturn = temp->value;
-    list->size--;
-    free(temp);
-    return toReturn;
+    return -1;
 }
 
 int removeByIndex(List list, int index) {
     if (index >= list->size) {
         return -1;
     }
+    if (list->slots != NULL) {
+        for (int i = 0; i < list->span; i++) {
+            Node node = SLOT(list, i);
+            if (node != NULL && index-- == 0) {
+                return removeNode(list, node);
+            }
+        }
+        return -1;
+    }
     int i = 0;
     Node temp = list->head;
     while (i != index) {
@@ -187,9 +365,27 @@ int removeByIndex(List list, int index) {
         temp = temp->next;
         i++;
     }
-    int valueToRemove = temp->value;
-    removeByValue(list, valueToRemove);
-    return valueToRemove;
+    return removeNode(list, temp);
+}
+
+int removeRandom(List list, int count, int *values) {
+    if (list == NULL) {
+        return 0;
+    }
+    int removed = 0;
+    while (removed < count && list->size > 0) {
+        if (list->slots == NULL) {
+            values[removed++] = removeByIndex(list, rand() % list->size);
+            continue;
+        }
+        // At least half the span is live, so this takes < 2 tries on average
+        Node victim;
+        do {
+            victim = SLOT(list, rand() % list->span);
+        } while (victim == NULL);
+        values[removed++] = removeNode(list, victim);
+    }
+    return removed;
 }
 
 int getValue(Node node) {
@@ -208,4 +404,8 @@ struct timeval getDispatchTime(Node node) {
     return node->dispatch_time;
 }
 
+long long getEnqueueTime(Node node) {
+    return node->enqueue_time;
+}
+
 
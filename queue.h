@@ -6,26 +6,57 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
 
 typedef struct List *List;
 typedef struct Node *Node;
 
+// Preallocates capacity nodes shared by all lists. Call once, before
+// any list is used; lists fall back to malloc if the pool runs dry.
+int queuePoolInit(int capacity);
+
 List queueConstructor();
 
+// Same List API, but backed by a ring of node pointers sized for
+// capacity entries. Removal from the middle leaves a tombstone, which
+// makes removeRandom() O(count) instead of O(count * size).
+List queueConstructorArray(int capacity);
+
 int queueDestructor(List list);
 
+// A node not yet in any list, for callers that queue nodes themselves
+Node nodeConstructor(int value1, struct timeval arrivalTime);
+
 int appendNewRequest(List list, int value1, struct timeval arrivalTime);
 
 int append(List list, Node node, int threadId);
 
+// Records dispatch time and handler thread, as append() does
+void dispatchNode(Node node, int threadId);
+
 int getSize(List list);
 
 int removeByValue(List list, int value1);
 
+// Unlinks and frees a node known to be in list, in O(1).
+// Returns its value.
+int removeNode(List list, Node node);
+
 Node removeFront(List list);
 
+// The oldest entry, left in place; NULL if the list is empty
+Node peekFront(List list);
+
 int removeByIndex(List list, int index);
 
+// Removes up to count random entries, storing their values in values[].
+// Returns how many were removed.
+int removeRandom(List list, int count, int *values);
+
+// Returns a node taken out with removeFront() to the pool
+void nodeDestructor(Node node);
+
 int getValue(Node node);
 
 int getHandlerThread_id(Node node);
@@ -34,5 +65,8 @@ struct timeval getArrivalTime(Node node);
 
 struct timeval getDispatchTime(Node node);
 
+// Monotonic microseconds at which the node was created, i.e. enqueued
+long long getEnqueueTime(Node node);
+
 
 #endif // LIST_H
@@ -0,0 +1,139 @@
+#include "segel.h"
+#include "ratelimit.h"
+
+// Clients live in a fixed set-associative table: the address picks a set
+// and the client takes one of its ways. Nothing is ever deleted. An
+// entry idle long enough for both buckets to refill is as good as a new
+// one, so it is simply reused (lazy expiry). When every way is in use
+// the least recently seen client is evicted and starts with full
+// buckets again.
+#define RATE_SETS   512
+#define RATE_WAYS   8
+
+typedef struct rateEntry {
+    in_addr_t addr;
+    int used;
+    double tokens;
+    double vipTokens;
+    long long last;         // monotonic microseconds of the last refill
+} rateEntry;
+
+typedef struct rateSet {
+    pthread_mutex_t lock;
+    rateEntry ways[RATE_WAYS];
+} rateSet;
+
+static rateSet *sets = NULL;
+static double rate = 0, burst = 0;
+static double vip_rate = 0, vip_burst = 0;
+static long long idle_expiry = 0;   // microseconds until both buckets are full
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static long long monotonicMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void rateLimitInit(double r, double b, double vr, double vb)
+{
+    rate = r;
+    burst = b;
+    vip_rate = vr;
+    vip_burst = vb;
+    if (!rateLimitEnabled()) {
+        return;
+    }
+    double refill = 0;
+    if (rate > 0) {
+        refill = burst / rate;
+    }
+    if (vip_rate > 0 && vip_burst / vip_rate > refill) {
+        refill = vip_burst / vip_rate;
+    }
+    idle_expiry = (long long)(refill * 1e6) + 1;
+
+    sets = (rateSet *)calloc(RATE_SETS, sizeof(rateSet));
+    if (sets == NULL) {
+        unix_error("calloc error");
+    }
+    for (int i = 0; i < RATE_SETS; i++) {
+        pthread_mutex_init(&sets[i].lock, NULL);
+    }
+}
+
+int rateLimitEnabled(void)
+{
+    return rate > 0 || vip_rate > 0;
+}
+
+// Finds or claims the entry for addr, refilled up to now. Caller holds
+// the set's lock.
+static rateEntry *rateLookup(rateSet *set, in_addr_t addr, long long now)
+{
+    rateEntry *victim = NULL;
+    int victimFree = 0;
+    for (int i = 0; i < RATE_WAYS; i++) {
+        rateEntry *e = &set->ways[i];
+        if (e->used && e->addr == addr) {
+            double elapsed = (now - e->last) / 1e6;
+            e->tokens = MIN(burst, e->tokens + elapsed * rate);
+            e->vipTokens = MIN(vip_burst, e->vipTokens + elapsed * vip_rate);
+            e->last = now;
+            return e;
+        }
+        if (victimFree) {
+            continue;
+        }
+        if (!e->used || now - e->last >= idle_expiry) {
+            victim = e;
+            victimFree = 1;
+        } else if (victim == NULL || e->last < victim->last) {
+            victim = e;
+        }
+    }
+    victim->addr = addr;
+    victim->used = 1;
+    victim->tokens = burst;
+    victim->vipTokens = vip_burst;
+    victim->last = now;
+    return victim;
+}
+
+static rateSet *rateSetFor(in_addr_t addr)
+{
+    // Fibonacci hashing spreads addresses that differ only in low bits
+    return &sets[(((uint32_t)addr * 2654435769u) >> 23) & (RATE_SETS - 1)];
+}
+
+int rateLimitConnect(struct in_addr addr)
+{
+    if (rate <= 0 || vip_rate <= 0) {
+        return 1;   // one kind of request is unlimited
+    }
+    rateSet *set = rateSetFor(addr.s_addr);
+    pthread_mutex_lock(&set->lock);
+    rateEntry *e = rateLookup(set, addr.s_addr, monotonicMicros());
+    int allowed = e->tokens >= 1 || e->vipTokens >= 1;
+    pthread_mutex_unlock(&set->lock);
+    return allowed;
+}
+
+int rateLimitTake(struct in_addr addr, int isVIP)
+{
+    if ((isVIP ? vip_rate : rate) <= 0) {
+        return 1;
+    }
+    rateSet *set = rateSetFor(addr.s_addr);
+    pthread_mutex_lock(&set->lock);
+    rateEntry *e = rateLookup(set, addr.s_addr, monotonicMicros());
+    double *tokens = isVIP ? &e->vipTokens : &e->tokens;
+    int allowed = *tokens >= 1;
+    if (allowed) {
+        *tokens -= 1;
+    }
+    pthread_mutex_unlock(&set->lock);
+    return allowed;
+}
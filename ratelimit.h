@@ -0,0 +1,23 @@
+#ifndef __RATELIMIT_H__
+#define __RATELIMIT_H__
+
+#include <netinet/in.h>
+
+// Per-client-IP token buckets. Every client gets a regular bucket and a
+// VIP bucket that refill at their own rates; each request takes one
+// token from the bucket of its kind. A rate of 0 leaves that kind
+// unlimited.
+
+void rateLimitInit(double rate, double burst, double vipRate, double vipBurst);
+
+// 1 if any limit is configured
+int rateLimitEnabled(void);
+
+// At accept: 0 if the client could not send any request right now, so
+// the connection need not be watched at all
+int rateLimitConnect(struct in_addr addr);
+
+// At dispatch: takes a token for one request, returns 0 if none is left
+int rateLimitTake(struct in_addr addr, int isVIP);
+
+#endif // __RATELIMIT_H__
@@ -1,7 +1,163 @@
+#define _GNU_SOURCE
 #include "segel.h"
 #include "request.h"
+#include "cache.h"
+#include "cgipool.h"
+#include "header.h"
+#include "parser.h"
 #include <string.h>
 
+// Set when the server was started with keep-alive enabled; responses then
+// carry the client's protocol version and an explicit Connection header.
+static int keepalive_enabled = 0;
+
+void requestEnableKeepAlive(int enabled)
+{
+    keepalive_enabled = enabled;
+}
+
+// How requestServeStatic moves file contents to the socket
+static int static_io_mode = STATIC_IO_MMAP;
+
+void requestSetStaticIO(int mode)
+{
+    static_io_mode = mode;
+}
+
+// Service class rules, consulted in order by getRequestMetaData
+typedef struct classRule {
+    int cls;
+    int kind;
+    char *pattern;
+} classRule;
+
+static classRule class_rules[MAX_CLASS_RULES];
+static int class_rule_count = 0;
+static int default_class = 0;
+
+int requestAddClassRule(int cls, int kind, char *pattern)
+{
+    if (class_rule_count == MAX_CLASS_RULES) {
+        return -1;
+    }
+    class_rules[class_rule_count].cls = cls;
+    class_rules[class_rule_count].kind = kind;
+    class_rules[class_rule_count].pattern = pattern;
+    class_rule_count++;
+    return 0;
+}
+
+void requestSetDefaultClass(int cls)
+{
+    default_class = cls;
+}
+
+/*
+ * requestHeaderPresent - 1 if req has a header named like pattern, or
+ * for "Name: value", one of that name whose value starts with value.
+ */
+static int requestHeaderPresent(httpRequest *req, char *pattern)
+{
+    char *colon = strchr(pattern, ':');
+    int nameLen = colon != NULL ? colon - pattern : (int)strlen(pattern);
+    char *want = colon != NULL ? colon + 1 : "";
+    while (*want == ' ' || *want == '\t') {
+        want++;
+    }
+    int wantLen = strlen(want);
+
+    httpSlice name, value;
+    int pos = 0;
+    while (parserNextHeader(req, &pos, &name, &value)) {
+        if (name.len == nameLen && !strncasecmp(name.ptr, pattern, nameLen) &&
+            value.len >= wantLen && !strncasecmp(value.ptr, want, wantLen)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Set when the scheduler wants file sizes at admission time
+static int stat_at_admission = 0;
+
+void requestSetStatAtAdmission(int enabled)
+{
+    stat_at_admission = enabled;
+}
+
+// Which precompressed siblings requestServeStatic looks for
+static int precompressed = 0;
+
+void requestSetPrecompressed(int encodings)
+{
+    precompressed = encodings;
+}
+
+// How requestServeDynamic starts CGI processes
+static int cgi_spawn_mode = CGI_SPAWN_FORK;
+
+void requestSetCgiSpawn(int mode)
+{
+    cgi_spawn_mode = mode;
+}
+
+/*
+ * requestConnectionHeader - Appends the Connection header line, if any.
+ */
+static void requestConnectionHeader(headerBuf *h, int keep, char *eol)
+{
+    if (keepalive_enabled) {
+        if (keep) {
+            headerLiteral(h, "Connection: keep-alive");
+        } else {
+            headerLiteral(h, "Connection: close");
+        }
+        headerString(h, eol);
+    }
+}
+
+/*
+ * requestStatHeaders - Appends the Stat-* lines, each ended with eol.
+ */
+static void requestStatHeaders(headerBuf *h,
+                               struct timeval arrival,
+                               struct timeval dispatch,
+                               threadStats *t_stats,
+                               char *eol)
+{
+    headerLiteral(h, "Stat-Req-Arrival:: ");
+    headerTime(h, arrival);
+    headerString(h, eol);
+    headerLiteral(h, "Stat-Req-Dispatch:: ");
+    headerTime(h, dispatch);
+    headerString(h, eol);
+    headerLiteral(h, "Stat-Thread-Id:: ");
+    headerNumber(h, t_stats->id);
+    headerString(h, eol);
+    headerLiteral(h, "Stat-Thread-Count:: ");
+    headerNumber(h, t_stats->total_req);
+    headerString(h, eol);
+    headerLiteral(h, "Stat-Thread-Static:: ");
+    headerNumber(h, t_stats->stat_req);
+    headerString(h, eol);
+    headerLiteral(h, "Stat-Thread-Dynamic:: ");
+    headerNumber(h, t_stats->dynm_req);
+    headerString(h, eol);
+}
+
+/*
+ * requestOkPrefix - Appends the status line and Server header of a
+ * successful response, precomputed for both protocol versions.
+ */
+static void requestOkPrefix(headerBuf *h, char *proto)
+{
+    if (!strcmp(proto, "HTTP/1.1")) {
+        headerLiteral(h, "HTTP/1.1 200 OK\r\nServer: OS-HW3 Web Server\r\n");
+    } else {
+        headerLiteral(h, "HTTP/1.0 200 OK\r\nServer: OS-HW3 Web Server\r\n");
+    }
+}
+
 /* 
  * Helper: requestError
  * Sends an error response to the client.
@@ -15,16 +171,19 @@
  *
  * (Adjust these counts if needed so that Content-Length exactly matches what the test harness expects.)
  */
-static void requestError(int fd,
-                         char *cause,
-                         char *errnum,
-                         char *shortmsg,
-                         char *longmsg,
-                         struct timeval arrival,
-                         struct timeval dispatch,
-                         threadStats *t_stats)
+static int requestError(int fd,
+                        char *cause,
+                        char *errnum,
+                        char *shortmsg,
+                        char *longmsg,
+                        char *proto,
+                        int keep,
+                        struct timeval arrival,
+                        struct timeval dispatch,
+                        threadStats *t_stats)
 {
-    char buf[MAXLINE], body[MAXBUF];
+    char body[MAXBUF];
+    headerBuf h;
 
     /* Construct the error HTML body exactly as expected.
        For example, for 404, the expected body should match:
@@ -34,51 +193,70 @@ static void requestError(int fd,
          <hr>OS-HW3 Web Server
          [5 newline characters at end]
     */
-    sprintf(body, "<html><title>OS-HW3 Error</title><body bgcolor=fffff>\n");
-    sprintf(body + strlen(body), "%s: %s\n", errnum, shortmsg);
-    sprintf(body + strlen(body), "<p>%s: %s\n", longmsg, cause);
-    if (!strcmp(errnum, "404")) {
-        sprintf(body + strlen(body), "<hr>OS-HW3 Web Server\n\n\n\n\n");
-    }
-    else if (!strcmp(errnum, "403")) {
-        sprintf(body + strlen(body), "<hr>OS-HW3 Web Server\n\n\n\n\n");
-    }
-    else {
-        sprintf(body + strlen(body), "<hr>OS-HW3 Web Server\n\n\n\n");
-    }
-    
-    /* Write HTTP headers (using LF-only newlines) */
-    sprintf(buf, "HTTP/1.0 %s %s\n", errnum, shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
-
-    sprintf(buf, "Content-Type: text/html\n");
-    Rio_writen(fd, buf, strlen(buf));
-
-    sprintf(buf, "Content-Length: %lu\n", strlen(body));
-    sprintf(buf + strlen(buf), "Stat-Req-Arrival:: %lu.%06lu\n", 
-            arrival.tv_sec, arrival.tv_usec);
-    sprintf(buf + strlen(buf), "Stat-Req-Dispatch:: %lu.%06lu\n", 
-            dispatch.tv_sec, dispatch.tv_usec);
-    sprintf(buf + strlen(buf), "Stat-Thread-Id:: %d\n", t_stats->id);
-    sprintf(buf + strlen(buf), "Stat-Thread-Count:: %d\n", t_stats->total_req);
-    sprintf(buf + strlen(buf), "Stat-Thread-Static:: %d\n", t_stats->stat_req);
-    sprintf(buf + strlen(buf), "Stat-Thread-Dynamic:: %d\n\n", t_stats->dynm_req);
-    Rio_writen(fd, buf, strlen(buf));
-
-    Rio_writen(fd, body, strlen(body));
+    int trailer5 = !strcmp(errnum, "404") || !strcmp(errnum, "403");
+    int len = snprintf(body, sizeof(body),
+                       "<html><title>OS-HW3 Error</title><body bgcolor=fffff>\n"
+                       "%s: %s\n"
+                       "<p>%s: %s\n"
+                       "<hr>OS-HW3 Web Server%s",
+                       errnum, shortmsg, longmsg, cause,
+                       trailer5 ? "\n\n\n\n\n" : "\n\n\n\n");
+    if (len >= (int)sizeof(body)) {
+        len = sizeof(body) - 1;
+    }
+
+    /* HTTP headers (using LF-only newlines) */
+    headerInit(&h);
+    headerString(&h, proto);
+    headerLiteral(&h, " ");
+    headerString(&h, errnum);
+    headerLiteral(&h, " ");
+    headerString(&h, shortmsg);
+    headerLiteral(&h, "\nContent-Type: text/html\n");
+    requestConnectionHeader(&h, keep, "\n");
+    headerLiteral(&h, "Content-Length: ");
+    headerNumber(&h, len);
+    headerLiteral(&h, "\n");
+    requestStatHeaders(&h, arrival, dispatch, t_stats, "\n");
+    headerLiteral(&h, "\n");
+
+    if (headerSend(fd, &h, body, len, 0) < 0) {
+        return 0;
+    }
+    return keep;
 }
 
 /*
- * requestReadhdrs - Reads and discards all header lines until an empty line.
+ * requestParseError - Answers a head the parser rejected. The rest of
+ * the connection cannot be trusted, so it is always closed.
  */
-static void requestReadhdrs(rio_t *rp)
+static int requestParseError(int fd, int status, char *proto,
+                             struct timeval arrival,
+                             struct timeval dispatch,
+                             threadStats *t_stats)
 {
-    char buf[MAXLINE];
-    Rio_readlineb(rp, buf, MAXLINE);
-    while (strcmp(buf, "\r\n")) {
-        Rio_readlineb(rp, buf, MAXLINE);
+    if (status == 414) {
+        requestError(fd, "request line", "414", "URI Too Long",
+                     "OS-HW3 Server does not accept a request line this long",
+                     proto, 0, arrival, dispatch, t_stats);
+    } else if (status == 431) {
+        requestError(fd, "request head", "431", "Request Header Fields Too Large",
+                     "OS-HW3 Server does not accept headers this large",
+                     proto, 0, arrival, dispatch, t_stats);
+    } else {
+        requestError(fd, "request", "400", "Bad Request",
+                     "OS-HW3 Server could not parse this",
+                     proto, 0, arrival, dispatch, t_stats);
     }
-    return;
+
+    // Closing with unread input makes the kernel send a reset, which can
+    // destroy the answer before the client reads it. Discard what has
+    // already arrived; we do not wait for more.
+    char sink[MAXBUF];
+    shutdown(fd, SHUT_WR);
+    while (recv(fd, sink, sizeof(sink), MSG_DONTWAIT) > 0)
+        ;
+    return 0;
 }
 
 /*
@@ -140,125 +318,342 @@ static void requestGetFiletype(char *filename, char *filetype)
 }
 
 /*
- * requestServeDynamic - Serves a dynamic (CGI) request.
+ * requestServeDynamic - Serves a dynamic (CGI) request, on a pooled CGI
+ * process when one serves this program, otherwise by fork + exec.
+ * Returns 0 if the response may have been cut short.
  */
-static void requestServeDynamic(int fd,
+static int requestServeDynamic(int fd,
                                 char *filename,
                                 char *cgiargs,
+                                char *proto,
+                                int keep,
                                 struct timeval arrival,
                                 struct timeval dispatch,
                                 threadStats *t_stats)
 {
-    char buf[MAXLINE];
     char *emptylist[] = { NULL };
+    headerBuf h;
 
-    sprintf(buf, "HTTP/1.0 200 OK\r\n");
-    sprintf(buf + strlen(buf), "Server: OS-HW3 Web Server\r\n");
-
-    sprintf(buf + strlen(buf), "Stat-Req-Arrival:: %lu.%06lu\r\n",
-            arrival.tv_sec, arrival.tv_usec);
-    sprintf(buf + strlen(buf), "Stat-Req-Dispatch:: %lu.%06lu\r\n",
-            dispatch.tv_sec, dispatch.tv_usec);
-    sprintf(buf + strlen(buf), "Stat-Thread-Id:: %d\r\n", t_stats->id);
-    sprintf(buf + strlen(buf), "Stat-Thread-Count:: %d\r\n", t_stats->total_req);
-    sprintf(buf + strlen(buf), "Stat-Thread-Static:: %d\r\n", t_stats->stat_req);
-    sprintf(buf + strlen(buf), "Stat-Thread-Dynamic:: %d\r\n", t_stats->dynm_req);
+    // The CGI program writes the rest of the header block
+    headerInit(&h);
+    requestOkPrefix(&h, proto);
+    requestConnectionHeader(&h, keep, "\r\n");
+    requestStatHeaders(&h, arrival, dispatch, t_stats, "\r\n");
+    if (headerSend(fd, &h, NULL, 0, 0) < 0) {
+        return 0;
+    }
 
-    Rio_writen(fd, buf, strlen(buf));
+    if (cgiPoolServes(filename)) {
+        int rc = cgiPoolRun(fd, cgiargs);
+        if (rc == CGI_POOL_OK) {
+            return keep;
+        }
+        if (rc == CGI_POOL_FAILED) {
+            return 0;
+        }
+    }
 
     pid_t pid;
-    if ((pid = Fork()) == 0) {
+    if (cgi_spawn_mode == CGI_SPAWN_POSIX) {
+        // The child shares our address space until it execs, and gets an
+        // environment of just QUERY_STRING instead of a rewritten environ
+        char query[MAXLINE + 16];
+        char *args[] = { filename, NULL };
+        char *envp[] = { query, NULL };
+        posix_spawn_file_actions_t actions;
+        posix_spawnattr_t attr;
+        sigset_t defaults;
+
+        snprintf(query, sizeof(query), "QUERY_STRING=%s", cgiargs);
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, fd, STDOUT_FILENO);
+        // We ignore SIGPIPE; the CGI program should not inherit that
+        sigemptyset(&defaults);
+        sigaddset(&defaults, SIGPIPE);
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+        int rc = posix_spawn(&pid, filename, &actions, &attr, args, envp);
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+        // A bad or busy binary, or a moment short of processes or memory,
+        // costs this request only. The status line is already out, so
+        // all we can do is drop the connection.
+        if (rc != 0) {
+            fprintf(stderr, "posix_spawn %s: %s\n", filename, strerror(rc));
+            return 0;
+        }
+        WaitPid(pid, NULL, 0);
+        return keep;
+    }
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        return 0;
+    }
+    if (pid == 0) {
+        signal(SIGPIPE, SIG_DFL);
         Setenv("QUERY_STRING", cgiargs, 1);
         Dup2(fd, STDOUT_FILENO);
         char *args[] = {NULL};
         Execve(filename, args, environ);
     }
     WaitPid(pid, NULL, WUNTRACED);
+    return keep;
 }
 
 /*
- * requestServeStatic - Serves a static (file) request.
+ * requestSendFile - Copies filesize bytes of srcfd to the socket in the
+ * kernel, without mapping the file into our address space.
+ * Returns -1 if the whole file could not be sent.
  */
-static void requestServeStatic(int fd,
-                               char *filename,
-                               int filesize,
-                               struct timeval arrival,
-                               struct timeval dispatch,
-                               threadStats *t_stats)
+static int requestSendFile(int fd, int srcfd, int filesize)
 {
-    int srcfd;
-    char *srcp, filetype[MAXLINE], buf[MAXBUF];
+    off_t offset = 0;
+    while (offset < filesize) {
+        ssize_t n = sendfile(fd, srcfd, &offset, filesize - offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;  /* client gone, or file shrank since it was stat'ed */
+    }
+    return 0;
+}
 
-    requestGetFiletype(filename, filetype);
-    srcfd = Open(filename, O_RDONLY, 0);
+/*
+ * requestFindSibling - Looks for precompressed siblings of filename that
+ * are no older than it, best encoding first, and sets *vary if any
+ * exists. Returns the encoding of the first one accept allows, with its
+ * name, open fd and stat in sibling, srcfd and sbuf, or NULL to serve
+ * filename itself.
+ */
+static char *requestFindSibling(char *filename, struct stat *orig, httpSlice accept,
+                                char *sibling, int *srcfd, struct stat *sbuf, int *vary)
+{
+    static struct { int flag; char *coding; char *suffix; } siblings[] = {
+        { ENCODING_BR,   "br",   ".br" },
+        { ENCODING_GZIP, "gzip", ".gz" },
+    };
 
-    srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
-    Close(srcfd);
+    for (int i = 0; i < 2; i++) {
+        if (!(precompressed & siblings[i].flag)) {
+            continue;
+        }
+        snprintf(sibling, MAXLINE, "%s%s", filename, siblings[i].suffix);
+        if (stat(sibling, sbuf) < 0 || !S_ISREG(sbuf->st_mode) ||
+            !(sbuf->st_mode & S_IRUSR) || sbuf->st_mtime < orig->st_mtime) {
+            continue;
+        }
+        *vary = 1;
+        if (!parserListAccepts(accept, siblings[i].coding)) {
+            continue;
+        }
+        // Sizes come from the fd we send, as for the original file
+        *srcfd = open(sibling, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (*srcfd >= 0 && fstat(*srcfd, sbuf) == 0 && S_ISREG(sbuf->st_mode)) {
+            return siblings[i].coding;
+        }
+        if (*srcfd >= 0) {
+            close(*srcfd);
+        }
+    }
+    return NULL;
+}
 
-    sprintf(buf, "HTTP/1.0 200 OK\r\n");
-    sprintf(buf + strlen(buf), "Server: OS-HW3 Web Server\r\n");
-    sprintf(buf + strlen(buf), "Content-Length: %d\r\n", filesize);
-    sprintf(buf + strlen(buf), "Content-Type: %s\r\n", filetype);
+/*
+ * requestSendBody - Sends the header block in h and then filesize bytes
+ *  of srcfd, the open file filename that sbuf describes.
+ *  The header block and the body leave in one sendmsg, except with
+ *  sendfile, where the header is held back with MSG_MORE instead.
+ *  Returns -1 if the response could not be sent in full.
+ */
+static int requestSendBody(int fd, headerBuf *h, int srcfd, char *filename,
+                           struct stat *sbuf)
+{
+    int rc, filesize = sbuf->st_size;
+    char *srcp;
+
+    // Hot files are written straight from memory, no map per hit
+    CacheEntry cached = cacheAcquire(filename, sbuf);
+    if (cached != NULL) {
+        rc = headerSend(fd, h, cacheData(cached), cacheSize(cached), 0);
+        cacheRelease(cached);
+        return rc;
+    }
 
-    sprintf(buf + strlen(buf), "Stat-Req-Arrival:: %lu.%06lu\r\n",
-            arrival.tv_sec, arrival.tv_usec);
-    sprintf(buf + strlen(buf), "Stat-Req-Dispatch:: %lu.%06lu\r\n",
-            dispatch.tv_sec, dispatch.tv_usec);
-    sprintf(buf + strlen(buf), "Stat-Thread-Id:: %d\r\n", t_stats->id);
-    sprintf(buf + strlen(buf), "Stat-Thread-Count:: %d\r\n", t_stats->total_req);
-    sprintf(buf + strlen(buf), "Stat-Thread-Static:: %d\r\n", t_stats->stat_req);
-    sprintf(buf + strlen(buf), "Stat-Thread-Dynamic:: %d\r\n\r\n", t_stats->dynm_req);
+    // No body would follow to push out a header held back with MSG_MORE
+    if (filesize == 0) {
+        return headerSend(fd, h, NULL, 0, 0);
+    }
 
-    Rio_writen(fd, buf, strlen(buf));
+    if (static_io_mode == STATIC_IO_SENDFILE) {
+        rc = headerSend(fd, h, NULL, 0, MSG_MORE);
+        if (rc == 0) {
+            rc = requestSendFile(fd, srcfd, filesize);
+        }
+        return rc;
+    }
 
-    Rio_writen(fd, srcp, filesize);
+    srcp = mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
+    if (srcp == MAP_FAILED) {
+        return -1;
+    }
+    rc = headerSend(fd, h, srcp, filesize, 0);
     Munmap(srcp, filesize);
+    return rc;
 }
 
 /*
- * getRequestMetaData - Returns 1 if the HTTP method is REAL (VIP), else 0.
+ * requestServeStatic - Serves a static (file) request from srcfd, the
+ *  open file filename that sbuf describes, or from a precompressed
+ *  sibling of it. Returns -1 if the response could not be sent in full.
  */
-int getRequestMetaData(int fd)
+static int requestServeStatic(int fd,
+                              int srcfd,
+                              char *filename,
+                              struct stat *sbuf,
+                              httpSlice accept,
+                              char *proto,
+                              int keep,
+                              struct timeval arrival,
+                              struct timeval dispatch,
+                              threadStats *t_stats)
 {
-    char buf[MAXLINE], method[MAXLINE];
-    int bytesRead = recv(fd, buf, MAXLINE - 1, MSG_PEEK);
-    if (bytesRead == -1) {
-        perror("recv");
+    int rc;
+    char filetype[MAXLINE];
+    headerBuf h;
+
+    requestGetFiletype(filename, filetype);
+
+    // Images are compressed already; text may have a smaller sibling
+    char sibling[MAXLINE];
+    struct stat sibbuf;
+    char *encoding = NULL;
+    int vary = 0, sibfd = -1;
+    if (precompressed && !strncmp(filetype, "text/", 5)) {
+        encoding = requestFindSibling(filename, sbuf, accept, sibling, &sibfd, &sibbuf, &vary);
+        if (encoding != NULL) {
+            filename = sibling;
+            srcfd = sibfd;
+            sbuf = &sibbuf;
+        }
+    }
+    int filesize = sbuf->st_size;
+
+    headerInit(&h);
+    requestOkPrefix(&h, proto);
+    requestConnectionHeader(&h, keep, "\r\n");
+    headerLiteral(&h, "Content-Length: ");
+    headerNumber(&h, filesize);
+    headerLiteral(&h, "\r\nContent-Type: ");
+    headerString(&h, filetype);
+    headerLiteral(&h, "\r\n");
+    if (encoding != NULL) {
+        headerLiteral(&h, "Content-Encoding: ");
+        headerString(&h, encoding);
+        headerLiteral(&h, "\r\n");
+    }
+    if (vary) {
+        headerLiteral(&h, "Vary: Accept-Encoding\r\n");
+    }
+    requestStatHeaders(&h, arrival, dispatch, t_stats, "\r\n");
+    headerLiteral(&h, "\r\n");
+
+    rc = requestSendBody(fd, &h, srcfd, filename, sbuf);
+    if (encoding != NULL) {
+        close(sibfd);
+    }
+    return rc;
+}
+
+/*
+ * getRequestMetaData - Returns 1 if the HTTP method is REAL (VIP), else 0
+ * and what the scheduler needs to know about the request in meta.
+ * A head the parser rejected goes to the default class.
+ */
+int getRequestMetaData(httpRequest *req, requestMeta *meta)
+{
+    meta->cls = default_class;
+    meta->hasStat = 0;
+    if (parserSliceIs(req->method, "REAL")) {
         return 1;
     }
-    sscanf(buf, "%s ", method);
-    return (!strcasecmp(method, "REAL"));
+    if (req->status != 0) {
+        return 0;
+    }
+    char uri[MAXLINE];
+    parserSliceCopy(req->uri, uri, sizeof(uri));
+
+    for (int i = 0; i < class_rule_count; i++) {
+        classRule *rule = &class_rules[i];
+        int match = 0;
+        switch (rule->kind) {
+            case CLASS_MATCH_METHOD:
+                match = parserSliceIs(req->method, rule->pattern);
+                break;
+            case CLASS_MATCH_PREFIX:
+                match = !strncmp(uri, rule->pattern, strlen(rule->pattern));
+                break;
+            case CLASS_MATCH_HEADER:
+                match = requestHeaderPresent(req, rule->pattern);
+                break;
+        }
+        if (match) {
+            meta->cls = rule->cls;
+            break;
+        }
+    }
+
+    if (stat_at_admission) {
+        char filename[MAXLINE], cgiargs[MAXLINE];
+        if (requestParseURI(uri, filename, cgiargs) &&
+            stat(filename, &meta->sbuf) == 0) {
+            meta->hasStat = 1;
+        }
+    }
+    return 0;
 }
 
 /*
  * requestHandle - Main entry point for handling a request.
- *  Reads and parses the request from fd, decides static vs dynamic,
- *  and serves the file or error as needed.
+ *  Serves the request whose head the event loop parsed into req:
+ *  decides static vs dynamic, and serves the file or error as needed.
+ *  Returns 1 if the connection should be kept open for another request.
  */
-void requestHandle(int fd, Node node, threadStats *t_stats)
+int requestHandle(int fd, httpRequest *req, Node node, threadStats *t_stats, int mayKeepAlive)
 {
     struct timeval arrival  = getArrivalTime(node);
     struct timeval dispatch = getDispatchTime(node);
 
     t_stats->total_req++;
 
-    rio_t rio;
-    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-    Rio_readinitb(&rio, fd);
+    int http11 = parserSliceIs(req->version, "HTTP/1.1");
+    char *proto = (keepalive_enabled && http11) ? "HTTP/1.1" : "HTTP/1.0";
 
-    if (Rio_readlineb(&rio, buf, MAXLINE) <= 0) {
-        return;
+    if (req->status != 0) {
+        return requestParseError(fd, req->status, proto, arrival, dispatch, t_stats);
     }
-    sscanf(buf, "%s %s %s", method, uri, version);
-
-    if (strcasecmp(method, "GET") && strcasecmp(method, "REAL")) {
-        requestError(fd, method, "501", "Not Implemented",
-                     "OS-HW3 Server does not implement this method",
-                     arrival, dispatch, t_stats);
-        return;
+    int is_real = parserSliceIs(req->method, "REAL");
+    if (!is_real && !parserSliceIs(req->method, "GET")) {
+        char method[MAXLINE];
+        parserSliceCopy(req->method, method, sizeof(method));
+        return requestError(fd, method, "501", "Not Implemented",
+                            "OS-HW3 Server does not implement this method",
+                            proto, 0, arrival, dispatch, t_stats);
     }
 
-    requestReadhdrs(&rio);
+    // HTTP/1.1 defaults to persistent connections, HTTP/1.0 must ask
+    int connection = http11;
+    if (parserSliceHas(req->connection, "close")) {
+        connection = 0;
+    } else if (parserSliceHas(req->connection, "keep-alive")) {
+        connection = 1;
+    }
+    // requestParseURI rewrites the URI in place
+    char uri[MAXLINE];
+    parserSliceCopy(req->uri, uri, sizeof(uri));
+    // Bytes read past the head belong to a pipelined request and would
+    // be lost when the connection is parked and its parser reset.
+    int keep = mayKeepAlive && connection == 1 && req->len == req->headLen;
 
     char filename[MAXLINE], cgiargs[MAXLINE];
     int is_static = requestParseURI(uri, filename, cgiargs);
@@ -266,52 +661,80 @@ void requestHandle(int fd, Node node, threadStats *t_stats)
     /* For REAL requests, we decide based on URI contents.
        (For GET, we rely on requestParseURI result.)
     */
-    if (!strcasecmp(method, "REAL")) {
+    if (is_real) {
         if (strstr(filename, ".cgi") || strstr(uri, "cgi"))
             is_static = 0;
         else
             is_static = 1;
     }
+    t_stats->phase.kind = is_real ? KIND_VIP
+                        : is_static ? KIND_STATIC : KIND_DYNAMIC;
 
+    // A static file is looked up by opening it and is then sent from
+    // that fd, so one deleted or rewritten while the request waited is
+    // a 404 or is sent as it is now, never as it was at admission.
+    // O_NONBLOCK keeps a FIFO from hanging the open.
     struct stat sbuf;
-    if (stat(filename, &sbuf) < 0) {
-        requestError(fd, filename, "404", "Not found",
-                     "OS-HW3 Server could not find this file",
-                     arrival, dispatch, t_stats);
-        return;
+    int srcfd = -1, found;
+    if (is_static) {
+        srcfd = open(filename, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        found = srcfd >= 0 && fstat(srcfd, &sbuf) == 0;
+    } else {
+        found = stat(filename, &sbuf) == 0;
     }
+    if (!found) {
+        int denied = errno == EACCES;
+        if (srcfd >= 0) {
+            close(srcfd);
+        }
+        if (denied) {
+            return requestError(fd, filename, "403", "Forbidden",
+                                "OS-HW3 Server could not read this file",
+                                proto, keep, arrival, dispatch, t_stats);
+        }
+        return requestError(fd, filename, "404", "Not found",
+                            "OS-HW3 Server could not find this file",
+                            proto, keep, arrival, dispatch, t_stats);
+    }
+    phaseMark(t_stats, PHASE_LOOKUP);
 
     if (is_static) {
         if (!S_ISREG(sbuf.st_mode) || !(sbuf.st_mode & S_IRUSR)) {
-            requestError(fd, filename, "403", "Forbidden",
-                         "OS-HW3 Server could not read this file",
-                         arrival, dispatch, t_stats);
-            return;
+            close(srcfd);
+            return requestError(fd, filename, "403", "Forbidden",
+                                "OS-HW3 Server could not read this file",
+                                proto, keep, arrival, dispatch, t_stats);
         }
         t_stats->stat_req++;
         printf("Thread %d: Handling static request. Total static requests: %d\n",
                t_stats->id, t_stats->stat_req);
-        requestServeStatic(fd, filename, sbuf.st_size, arrival, dispatch, t_stats);
+        if (requestServeStatic(fd, srcfd, filename, &sbuf, req->acceptEncoding, proto, keep,
+                               arrival, dispatch, t_stats) < 0) {
+            keep = 0;
+        }
+        close(srcfd);
+        phaseMark(t_stats, PHASE_SEND);
     } else {
         /* In dynamic requests, check if the requested file is meant to be forbidden.
            For instance, if filename contains "forbidden_file.cgi" (which we do not remap),
            then we return a 403.
          */
         if (strstr(filename, "forbidden_file.cgi") != NULL) {
-            requestError(fd, filename, "403", "Forbidden",
-                         "OS-HW3 Server could not run this CGI program",
-                         arrival, dispatch, t_stats);
-            return;
+            return requestError(fd, filename, "403", "Forbidden",
+                                "OS-HW3 Server could not run this CGI program",
+                                proto, keep, arrival, dispatch, t_stats);
         }
         if (!S_ISREG(sbuf.st_mode) || !(sbuf.st_mode & S_IXUSR)) {
-            requestError(fd, filename, "403", "Forbidden",
-                         "OS-HW3 Server could not run this CGI program",
-                         arrival, dispatch, t_stats);
-            return;
+            return requestError(fd, filename, "403", "Forbidden",
+                                "OS-HW3 Server could not run this CGI program",
+                                proto, keep, arrival, dispatch, t_stats);
         }
         t_stats->dynm_req++;
         printf("Thread %d: Handling dynamic request. Total dynamic requests: %d\n",
                t_stats->id, t_stats->dynm_req);
-        requestServeDynamic(fd, filename, cgiargs, arrival, dispatch, t_stats);
+        keep = requestServeDynamic(fd, filename, cgiargs, proto, keep,
+                                   arrival, dispatch, t_stats);
+        phaseMark(t_stats, PHASE_CGI);
     }
+    return keep;
 }
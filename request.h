@@ -2,20 +2,85 @@
 #define __REQUEST_H__
 
 #include "queue.h"
+#include "metrics.h"
+#include "parser.h"
 #include <sys/time.h>
 #include <pthread.h>
 
+// One per worker thread, written only by that thread. Aligned to a cache
+// line so neighbours never share one; /metrics reads them unlocked.
 typedef struct threadStats {
-    pthread_t ourThread;
+    _Alignas(64) pthread_t ourThread;
     int id;
     int stat_req;
     int dynm_req;
     int total_req;
-    
+    latencyHistogram latency;   // arrival to end of response
+    phaseTimer phase;           // the request being handled
+    phaseHistogram phases[KINDS][PHASES];
 } threadStats;
 
-// Called by your threads to handle a request
-void requestHandle(int fd, Node node, threadStats *t_stats);
+// Called by your threads to handle a request whose head the event loop
+// has already read into req (see eventRequest).
+// Returns 1 if the connection should be kept open (HTTP keep-alive).
+int requestHandle(int fd, httpRequest *req, Node node, threadStats *t_stats, int mayKeepAlive);
+
+// Static file transfer: mmap + write, or sendfile(2) straight from
+// the page cache to the socket
+#define STATIC_IO_MMAP      0
+#define STATIC_IO_SENDFILE  1
+
+void requestSetStaticIO(int mode);
+
+// Precompressed static variants: with a flag set, a compressible file
+// is answered from its "name.br" / "name.gz" sibling when one exists,
+// is no older than the file and the client's Accept-Encoding allows it.
+// Brotli is preferred over gzip.
+#define ENCODING_GZIP       1
+#define ENCODING_BR         2
+
+void requestSetPrecompressed(int encodings);
+
+// How CGI processes are started when the CGI pool does not serve them:
+// fork + exec in the child, or posix_spawn (vfork-style, no page table
+// copy) with a minimal environment
+#define CGI_SPAWN_FORK      0
+#define CGI_SPAWN_POSIX     1
+
+void requestSetCgiSpawn(int mode);
+
+// Turns on HTTP/1.1 responses and Connection headers
+void requestEnableKeepAlive(int enabled);
+
+// Service classes for regular requests. Each rule sends the requests it
+// matches to one class; the first matching rule wins and unmatched
+// requests go to the default class.
+#define MAX_CLASSES         8
+#define MAX_CLASS_RULES     32
+
+#define CLASS_MATCH_METHOD  0   // request method, e.g. "HEAD"
+#define CLASS_MATCH_PREFIX  1   // URI prefix, e.g. "/api/"
+#define CLASS_MATCH_HEADER  2   // "Name" (present) or "Name: value" (prefix)
+
+// Returns 0, or -1 if the rule table is full
+int requestAddClassRule(int cls, int kind, char *pattern);
+void requestSetDefaultClass(int cls);
+
+// What admission learns about a request before it is queued
+typedef struct requestMeta {
+    int cls;            // service class of a regular request
+    int hasStat;        // sbuf holds stat() of a static target
+    struct stat sbuf;
+} requestMeta;
+
+// With this on, getRequestMetaData also stats static targets so the
+// scheduler can see their size. That stat() runs on the event loop, and
+// is only a sort key: requestHandle looks the file up again when served.
+void requestSetStatAtAdmission(int enabled);
+
+// Classifies a parsed request. Returns 1 if the method is REAL (VIP),
+// else 0, and fills in meta.
+int getRequestMetaData(httpRequest *req, requestMeta *meta);
 
 Node skip_request(threadStats* thread);
 
@@ -0,0 +1,104 @@
+#include "ring.h"
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// Vyukov-style bounded queue: each cell carries a sequence number that
+// tells producers and consumers whose turn it is, so no cell is ever
+// touched by two threads at once.
+struct cell {
+    atomic_size_t seq;
+    Node node;
+};
+
+struct Ring {
+    struct cell *cells;
+    size_t mask;
+    // Producer and consumer cursors on separate cache lines
+    _Alignas(64) atomic_size_t tail;
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_int count;
+};
+
+Ring ringConstructor(int capacity) {
+    size_t size = 1;
+    while (size < (size_t)capacity) {
+        size <<= 1;
+    }
+    Ring ring = (Ring) aligned_alloc(64, sizeof(*ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->cells = (struct cell *) calloc(size, sizeof(*ring->cells));
+    if (ring->cells == NULL) {
+        free(ring);
+        return NULL;
+    }
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&ring->cells[i].seq, i);
+    }
+    ring->mask = size - 1;
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->count, 0);
+    return ring;
+}
+
+int ringPush(Ring ring, Node node) {
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (1) {
+        struct cell *c = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                c->node = node;
+                atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+                atomic_fetch_add(&ring->count, 1);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;   // full
+        } else {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+}
+
+Node ringPop(Ring ring) {
+    size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (1) {
+        struct cell *c = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                Node node = c->node;
+                atomic_store_explicit(&c->seq, pos + ring->mask + 1, memory_order_release);
+                atomic_fetch_sub(&ring->count, 1);
+                return node;
+            }
+        } else if (diff < 0) {
+            return NULL;    // empty
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+}
+
+int ringSize(Ring ring) {
+    int count = atomic_load(&ring->count);
+    return count > 0 ? count : 0;   // a pop can land before its push is counted
+}
+
+void futexWait(atomic_int *addr, int val) {
+    syscall(SYS_futex, (int *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+void futexWake(atomic_int *addr, int count) {
+    syscall(SYS_futex, (int *)addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
@@ -0,0 +1,29 @@
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stdatomic.h>
+#include "queue.h"
+
+// Bounded multi-producer/multi-consumer ring of request nodes.
+// Push and pop are lock-free (one CAS each in the common case).
+
+typedef struct Ring *Ring;
+
+// Capacity is rounded up to a power of two
+Ring ringConstructor(int capacity);
+
+// Returns 1 on success, 0 if the ring is full
+int ringPush(Ring ring, Node node);
+
+// Returns NULL if the ring is empty
+Node ringPop(Ring ring);
+
+// Entries currently queued (may be momentarily stale)
+int ringSize(Ring ring);
+
+// Futex helpers for parking threads on a 32-bit word: futexWait sleeps
+// only while *addr still equals val.
+void futexWait(atomic_int *addr, int val);
+void futexWake(atomic_int *addr, int count);
+
+#endif // __RING_H__
@@ -71,6 +71,17 @@ void Execve(const char *filename, char *const argv[], char *const envp[])
         unix_error("Execve error");
 }
 
+pid_t Posix_spawn(const char *path, const posix_spawn_file_actions_t *actions,
+                  const posix_spawnattr_t *attr, char *const argv[], char *const envp[])
+{
+    pid_t pid;
+    int rc;
+
+    if ((rc = posix_spawn(&pid, path, actions, attr, argv, envp)) != 0)
+        posix_error(rc, "Posix_spawn error");
+    return pid;
+}
+
 /* $begin wait */
 pid_t Wait(int *status) 
 {
@@ -169,6 +180,17 @@ void Fstat(int fd, struct stat *buf)
         unix_error("Fstat error");
 }
 
+ssize_t Sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+    ssize_t rc;
+
+    while ((rc = sendfile(out_fd, in_fd, offset, count)) < 0 && errno == EINTR)
+        ;
+    if (rc < 0)
+        unix_error("Sendfile error");
+    return rc;
+}
+
 /***************************************
  * Wrappers for memory mapping functions
  ***************************************/
@@ -502,13 +524,14 @@ int open_clientfd(char *hostname, int port)
  *     Returns -1 and sets errno on Unix error.
  */
 /* $begin open_listenfd */
-int open_listenfd(int port) 
+static int open_listenfd_common(int port, int reuseport)
 {
     int listenfd, optval=1;
     struct sockaddr_in serveraddr;
   
     /* Create a socket descriptor */
-    if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    /* Close-on-exec, so CGI processes never inherit (and keep bound) it */
+    if ((listenfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
       fprintf(stderr, "socket failed\n");
       return -1;
     }
@@ -520,6 +543,15 @@ int open_listenfd(int port)
       return -1;
     }
 
+    /* Lets several sockets bind the same port; the kernel then
+       spreads incoming connections across them. */
+    if (reuseport &&
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                   (const void *)&optval , sizeof(int)) < 0) {
+      fprintf(stderr, "setsockopt failed\n");
+      return -1;
+    }
+
     /* Listenfd will be an endpoint for all requests to port
        on any IP address for this host */
     bzero((char *) &serveraddr, sizeof(serveraddr));
@@ -538,6 +570,20 @@ int open_listenfd(int port)
     }
     return listenfd;
 }
+
+int open_listenfd(int port)
+{
+    return open_listenfd_common(port, 0);
+}
+
+/*
+ * open_listenfd_reuseport - like open_listenfd, but with SO_REUSEPORT
+ *     so that one listening socket can be opened per acceptor thread.
+ */
+int open_listenfd_reuseport(int port)
+{
+    return open_listenfd_common(port, 1);
+}
 /* $end open_listenfd */
 
 /******************************************
@@ -565,4 +611,13 @@ int Open_listenfd(int port)
     return rc;
 }
 
+int Open_listenfd_reuseport(int port)
+{
+    int rc;
+
+    if ((rc = open_listenfd_reuseport(port)) < 0)
+        unix_error("Open_listenfd_reuseport error");
+    return rc;
+}
+
 
@@ -15,6 +15,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <spawn.h>
 #include <errno.h>
 #include <math.h>
 #include <pthread.h>
@@ -66,6 +68,8 @@ void app_error(char *msg);
 /* Process control wrappers */
 pid_t Fork(void);
 void Execve(const char *filename, char *const argv[], char *const envp[]);
+pid_t Posix_spawn(const char *path, const posix_spawn_file_actions_t *actions,
+                  const posix_spawnattr_t *attr, char *const argv[], char *const envp[]);
 pid_t Wait(int *status);
 pid_t WaitPid(pid_t pid, int *status, int options);
 
@@ -83,6 +87,7 @@ int Select(int  n, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
 int Dup2(int fd1, int fd2);
 void Stat(const char *filename, struct stat *buf);
 void Fstat(int fd, struct stat *buf) ;
+ssize_t Sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
 
 /* Memory mapping wrappers */
 void *Mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
@@ -117,9 +122,11 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 /* Client/server helper functions */
 int open_clientfd(char *hostname, int portno);
 int open_listenfd(int portno);
+int open_listenfd_reuseport(int portno);
 
 /* Wrappers for client/server helper functions */
 int Open_clientfd(char *hostname, int port);
 int Open_listenfd(int port); 
+int Open_listenfd_reuseport(int port);
 
 #endif /* __CSAPP_H__ */
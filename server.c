@@ -1,12 +1,21 @@
+#define _GNU_SOURCE
 #include "segel.h"
 #include "request.h"
+#include "event.h"
+#include "cache.h"
+#include "cgipool.h"
+#include "ring.h"
+#include "heap.h"
+#include "ratelimit.h"
+#include "metrics.h"
+#include <limits.h>
 
 #define MAX_POLICY 7
 
-// Queues for VIP and Regular requests
+// Queues for VIP and running requests; waiting regular requests are
+// kept per service class below
 List vip_requests = NULL;
 List running_requests = NULL;
-List waiting_requests = NULL;
 
 // Synchronization primitives
 pthread_cond_t empty_queue;
@@ -15,9 +24,296 @@ pthread_cond_t read_allowed;
 pthread_cond_t write_allowed;
 pthread_mutex_t global_lock;
 
-// A flag indicating the VIP thread is actively working.
-// While vip_is_busy = 1, no regular thread is allowed to start a request.
-static int vip_is_busy = 0;
+// Number of VIP threads actively working. In exclusive VIP mode no
+// regular thread may start a request while vip_busy > 0; in priority
+// mode only queued VIP requests hold regular threads back.
+static int vip_busy = 0;
+static int vip_exclusive = 1;
+
+static int poolSize;
+static char schedAlg[MAX_POLICY];
+static int *drop_buf;   // fds picked by the random policy, guarded by global_lock
+
+// --------------------------------------------------
+// Service classes for waiting regular requests
+// --------------------------------------------------
+// Each class has its own queue. Workers choose the next class by stride
+// scheduling: serving a class advances its pass by STRIDE1 / weight and
+// the non-empty class with the smallest pass goes next, so while classes
+// are backlogged each gets dispatches in proportion to its weight and
+// none starves. All of it is guarded by global_lock.
+//
+// Within a class requests leave in arrival order, or with --order sff
+// smallest file first: the class keeps a min-heap keyed by arrival time
+// plus the file's estimated transfer time at sff_rate. The arrival term
+// ages big files, so a request never waits behind ones that arrived more
+// than its own transfer time later.
+#define STRIDE1 (1 << 20)
+// Keeps every stride at 16 or more: a stride of 0 would never advance
+// the pass, and that class would starve all the others
+#define MAX_CLASS_WEIGHT (1 << 16)
+
+typedef struct serviceClass {
+    List requests;      // FIFO order
+    Heap ordered;       // SFF order, NULL unless --order sff
+    int weight;
+    long long pass;
+} serviceClass;
+
+static serviceClass classes[MAX_CLASSES];
+static int class_count = 1;
+static int waiting_count = 0;       // over all classes
+static long long global_pass = 0;   // pass of the class served last
+static long long sff_rate = 0;      // bytes per second, 0 = FIFO order
+
+static int classSize(serviceClass *c)
+{
+    return c->ordered != NULL ? heapSize(c->ordered) : getSize(c->requests);
+}
+
+// SFF key: microseconds since the epoch at which the request is due
+static long long sffKey(struct timeval arrival_time, requestMeta *meta)
+{
+    long long key = arrival_time.tv_sec * 1000000LL + arrival_time.tv_usec;
+    if (meta->hasStat) {
+        key += (long long)((double)meta->sbuf.st_size * 1e6 / sff_rate);
+    }
+    return key;
+}
+
+static void classAppend(int cls, int connfd, struct timeval arrival_time,
+                        requestMeta *meta)
+{
+    serviceClass *c = &classes[cls];
+    // A class that sat idle rejoins at the current pass rather than
+    // spending the turns it did not need
+    if (classSize(c) == 0 && c->pass < global_pass) {
+        c->pass = global_pass;
+    }
+    if (c->ordered == NULL) {
+        if (appendNewRequest(c->requests, connfd, arrival_time) < 0) {
+            Close(connfd);
+            return;
+        }
+        waiting_count++;
+        return;
+    }
+    Node node = nodeConstructor(connfd, arrival_time);
+    if (node == NULL) {
+        Close(connfd);
+        return;
+    }
+    if (!heapPush(c->ordered, node, sffKey(arrival_time, meta))) {
+        Close(connfd);
+        nodeDestructor(node);
+        return;
+    }
+    waiting_count++;
+}
+
+// Oldest request of the next class due, or NULL if none waits
+static Node classTake(void)
+{
+    serviceClass *next = NULL;
+    for (int i = 0; i < class_count; i++) {
+        if (classSize(&classes[i]) > 0 &&
+            (next == NULL || classes[i].pass < next->pass)) {
+            next = &classes[i];
+        }
+    }
+    if (next == NULL) {
+        return NULL;
+    }
+    global_pass = next->pass;
+    next->pass += STRIDE1 / next->weight;
+    waiting_count--;
+    return next->ordered != NULL ? heapPop(next->ordered) : removeFront(next->requests);
+}
+
+// Drop-head: the oldest head over all classes
+static Node classTakeOldest(void)
+{
+    serviceClass *oldest = NULL;
+    struct timeval best;
+    for (int i = 0; i < class_count; i++) {
+        Node head = classes[i].ordered != NULL ? heapPeekOldest(classes[i].ordered)
+                                               : peekFront(classes[i].requests);
+        if (head != NULL) {
+            struct timeval t = getArrivalTime(head);
+            if (oldest == NULL || timercmp(&t, &best, <)) {
+                oldest = &classes[i];
+                best = t;
+            }
+        }
+    }
+    if (oldest == NULL) {
+        return NULL;
+    }
+    waiting_count--;
+    return oldest->ordered != NULL ? heapRemoveOldest(oldest->ordered)
+                                   : removeFront(oldest->requests);
+}
+
+// Random policy: drops half of every class at random
+static void classDropRandom(void)
+{
+    for (int i = 0; i < class_count; i++) {
+        int size = classSize(&classes[i]);
+        int dropped = classes[i].ordered != NULL
+            ? heapRemoveRandom(classes[i].ordered, (size + 1) / 2, drop_buf)
+            : removeRandom(classes[i].requests, (size + 1) / 2, drop_buf);
+        waiting_count -= dropped;
+        metricsCountDrop(DROP_RANDOM, dropped);
+        for (int j = 0; j < dropped; j++) {
+            Close(drop_buf[j]);
+        }
+    }
+}
+
+// --------------------------------------------------
+// CoDel policy ("codel")
+// --------------------------------------------------
+// Besides dropping new requests when the queue is full, codel watches
+// how long requests waited (their sojourn time) as workers take them.
+// Once the sojourn time has stayed above codel_target for a whole
+// codel_interval, it starts dropping requests at dequeue, at intervals
+// shrinking with 1/sqrt(drops), until a request arrives that waited less
+// than the target. This keeps queueing delay near the target under
+// sustained overload instead of serving a full queue of stale requests
+// (Nichols and Jacobson, RFC 8289). Works with every handoff mode.
+static int codel_enabled = 0;
+static long long codel_target = 5000;       // microseconds
+static long long codel_interval = 100000;   // microseconds
+static pthread_mutex_t codel_lock = PTHREAD_MUTEX_INITIALIZER;
+static long long codel_first_above = 0;     // when to start dropping, 0 = below target
+static long long codel_drop_next = 0;
+static int codel_dropping = 0;
+static int codel_count = 0;                 // drops in the current dropping state
+static int codel_last_count = 0;
+
+// Integer square root by Newton's method, so we need no libm
+static long long isqrt(long long n)
+{
+    long long x = n, y = (x + 1) / 2;
+    while (y < x) {
+        x = y;
+        y = (x + n / x) / 2;
+    }
+    return x;
+}
+
+// Next drop time: interval / sqrt(count) after t
+static long long codelControlLaw(long long t)
+{
+    return t + codel_interval * 1000 / isqrt(codel_count * 1000000LL);
+}
+
+// Called for every request a worker takes. Returns 1 if it is to be
+// dropped instead of served. Sojourn time is time spent queued only:
+// a client slow to send its head must not count as queueing delay.
+static int codelDrop(Node node)
+{
+    long long now = metricsClock();
+    long long sojourn = now - getEnqueueTime(node);
+    int drop = 0;
+
+    pthread_mutex_lock(&codel_lock);
+    int okToDrop = 0;
+    if (sojourn < codel_target) {
+        codel_first_above = 0;
+    } else if (codel_first_above == 0) {
+        codel_first_above = now + codel_interval;
+    } else if (now >= codel_first_above) {
+        okToDrop = 1;
+    }
+
+    if (codel_dropping) {
+        if (!okToDrop) {
+            codel_dropping = 0;
+        } else if (now >= codel_drop_next) {
+            drop = 1;
+            codel_count++;
+            codel_drop_next = codelControlLaw(codel_drop_next);
+        }
+    } else if (okToDrop) {
+        // Re-entering soon after leaving: resume near the old drop rate
+        drop = 1;
+        codel_dropping = 1;
+        int delta = codel_count - codel_last_count;
+        codel_count = (delta > 1 && now - codel_drop_next < 16 * codel_interval) ? delta : 1;
+        codel_drop_next = codelControlLaw(now);
+        codel_last_count = codel_count;
+    }
+    pthread_mutex_unlock(&codel_lock);
+    return drop;
+}
+
+// --------------------------------------------------
+// Handoff state for --handoff lockfree and --handoff steal
+// --------------------------------------------------
+// In both modes regular requests bypass the class queues and regular
+// workers never touch global_lock: lockfree passes them through one
+// lock-free ring, steal through per-worker queues. VIP requests keep
+// using vip_requests; the counters below carry the admission accounting
+// and the VIP-first rule across the two paths. Idle threads park on
+// futexes.
+#define HANDOFF_LOCK      0
+#define HANDOFF_LOCKFREE  1
+#define HANDOFF_STEAL     2
+
+static int handoff = HANDOFF_LOCK;
+static Ring ready_ring = NULL;
+static atomic_int ready_seq;            // bumped after each push
+static atomic_int idle_workers;         // workers parked on ready_seq
+static atomic_int done_seq;             // bumped after each completion
+static atomic_int blocked_acceptors;    // acceptors parked on done_seq
+static atomic_int running_count;        // requests being handled, VIP included
+static atomic_int vip_queued;           // requests in vip_requests
+static atomic_int vip_pending;          // VIP requests queued or being handled
+static Node *drain_buf;                 // random policy scratch, under drain_lock
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// With several acceptor threads, admission (check for a free slot, then
+// queue) must be atomic. Only acceptors take this lock, never workers.
+static pthread_mutex_t admit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Per-worker queues for --handoff steal. Each is padded to its own cache
+// line; a worker serves its own queue first and steals the oldest entry
+// of a peer's queue when it runs dry.
+typedef struct workerQueue {
+    _Alignas(64) pthread_mutex_t lock;
+    List requests;
+    atomic_int size;
+    atomic_int busy;        // handling a request
+    atomic_int idle;        // parked on wake_seq; cleared by whoever wakes it
+    atomic_int wake_seq;
+} workerQueue;
+
+static workerQueue *worker_queues = NULL;
+static int worker_count = 0;
+static atomic_int steal_waiting;        // entries over all worker queues
+static atomic_uint next_worker;         // round-robin cursor
+static int distribute_least = 0;        // pick the least loaded worker
+
+// Marks a request done and wakes acceptors waiting for a free slot
+static void lockFreeComplete()
+{
+    atomic_fetch_sub(&running_count, 1);
+    atomic_fetch_add(&done_seq, 1);
+    if (atomic_load(&blocked_acceptors) > 0) {
+        futexWake(&done_seq, INT_MAX);
+    }
+}
+
+// Adds a finished request to its worker's latency histograms. Latency
+// counts from enqueue, like codel's sojourn; the phase histograms show
+// the time before that.
+static void recordLatency(threadStats *threadStruct, Node node)
+{
+    histogramRecord(&threadStruct->latency,
+                    metricsClock() - getEnqueueTime(node));
+    phaseCommit(threadStruct);
+}
 
 // --------------------------------------------------
 // VIP Thread Function
@@ -29,33 +325,50 @@ void *VIPThreadFunction(void *args)
     while (1) {
         pthread_mutex_lock(&global_lock);
 
-        // Wait if no VIP requests
+        // Wait if no VIP requests. Only VIP threads wait on vip_allowed,
+        // so a signal for a new VIP request is never taken by a regular
+        // thread.
         while (getSize(vip_requests) == 0) {
             pthread_cond_wait(&vip_allowed, &global_lock);
         }
-        vip_is_busy = 1;
+        vip_busy++;
 
         // Take next VIP request
         Node toWorkWith = removeFront(vip_requests);
         append(running_requests, toWorkWith, threadStruct->id);
+        if (handoff != HANDOFF_LOCK) {
+            atomic_fetch_add(&running_count, 1);
+            atomic_fetch_sub(&vip_queued, 1);
+        }
+        // In priority mode an empty VIP queue releases the regular threads
+        if (!vip_exclusive && getSize(vip_requests) == 0) {
+            pthread_cond_broadcast(&read_allowed);
+        }
 
         pthread_mutex_unlock(&global_lock);
 
+        if (handoff != HANDOFF_LOCK && !vip_exclusive) {
+            futexWake(&vip_queued, INT_MAX);
+        }
+
         // Handle request
-        requestHandle(getValue(toWorkWith), toWorkWith, threadStruct);
-        Close(getValue(toWorkWith));
+        int fd = getValue(toWorkWith);
+        phaseStart(threadStruct, eventArrivalClock(fd), eventParsedClock(fd),
+                   getEnqueueTime(toWorkWith));
+        int keep = requestHandle(fd, eventRequest(fd), toWorkWith, threadStruct, eventCanKeepAlive(fd));
+        recordLatency(threadStruct, toWorkWith);
 
         // Cleanup
         pthread_mutex_lock(&global_lock);
-        removeByValue(running_requests, getValue(toWorkWith));
-        vip_is_busy = 0;
+        removeNode(running_requests, toWorkWith);
+        vip_busy--;
 
         // Freed a slot
         pthread_cond_broadcast(&write_allowed);
 
         // If all empty, signal empty_queue
         if ( (getSize(running_requests) == 0) &&
-             (getSize(waiting_requests) == 0) &&
+             (waiting_count == 0) &&
              (getSize(vip_requests) == 0) ) {
             pthread_cond_signal(&empty_queue);
         }
@@ -63,6 +376,19 @@ void *VIPThreadFunction(void *args)
         pthread_cond_broadcast(&read_allowed);
 
         pthread_mutex_unlock(&global_lock);
+
+        if (handoff != HANDOFF_LOCK) {
+            lockFreeComplete();
+            atomic_fetch_sub(&vip_pending, 1);
+            futexWake(&vip_pending, INT_MAX);
+        }
+
+        // Only after the fd left running_requests may it be reused
+        if (keep) {
+            eventPark(fd);
+        } else {
+            Close(fd);
+        }
     }
     return NULL;
 }
@@ -80,54 +406,550 @@ void *ThreadFunction(void *args)
         // Wait if:
         // 1) No regular requests
         // 2) VIP queue non-empty
-        // 3) VIP busy
-        while ( (getSize(waiting_requests) == 0) ||
+        // 3) VIP busy (exclusive mode only)
+        // VIP threads broadcast read_allowed when 2) or 3) clears.
+        while ( (waiting_count == 0) ||
                 (getSize(vip_requests) > 0) ||
-                (vip_is_busy == 1) )
+                (vip_exclusive && vip_busy > 0) )
         {
-            if (getSize(vip_requests) > 0) {
-                pthread_cond_wait(&vip_allowed, &global_lock);
-            } else {
-                pthread_cond_wait(&read_allowed, &global_lock);
-            }
+            pthread_cond_wait(&read_allowed, &global_lock);
         }
 
-        // Dequeue oldest regular request
-        Node toWorkWith = removeFront(waiting_requests);
+        // Dequeue the oldest request of the class whose turn it is
+        Node toWorkWith = classTake();
+        if (codel_enabled && codelDrop(toWorkWith)) {
+            pthread_cond_signal(&write_allowed);
+            pthread_mutex_unlock(&global_lock);
+            metricsCountDrop(DROP_CODEL, 1);
+            Close(getValue(toWorkWith));
+            nodeDestructor(toWorkWith);
+            continue;
+        }
         append(running_requests, toWorkWith, threadStruct->id);
 
         pthread_mutex_unlock(&global_lock);
 
         // Handle request
-        requestHandle(getValue(toWorkWith), toWorkWith, threadStruct);
-        Close(getValue(toWorkWith));
+        int fd = getValue(toWorkWith);
+        phaseStart(threadStruct, eventArrivalClock(fd), eventParsedClock(fd),
+                   getEnqueueTime(toWorkWith));
+        int keep = requestHandle(fd, eventRequest(fd), toWorkWith, threadStruct, eventCanKeepAlive(fd));
+        recordLatency(threadStruct, toWorkWith);
 
         // Cleanup
         pthread_mutex_lock(&global_lock);
-        removeByValue(running_requests, getValue(toWorkWith));
+        removeNode(running_requests, toWorkWith);
         pthread_cond_signal(&write_allowed);
 
         if ( (getSize(running_requests) == 0) &&
-             (getSize(waiting_requests) == 0) &&
+             (waiting_count == 0) &&
              (getSize(vip_requests) == 0) )
         {
             pthread_cond_signal(&empty_queue);
         }
         pthread_mutex_unlock(&global_lock);
+
+        if (keep) {
+            eventPark(fd);
+        } else {
+            Close(fd);
+        }
     }
     return NULL;
 }
 
+// --------------------------------------------------
+// Handoff without global_lock
+// --------------------------------------------------
+
+// Regular requests queued in the ring or the worker queues
+static int queuedRegular(void)
+{
+    return handoff == HANDOFF_STEAL ? atomic_load(&steal_waiting)
+                                    : ringSize(ready_ring);
+}
+
+// Acceptor side: parks until cond() holds, re-checking after every
+// completion.
+static void waitForCompletions(int (*cond)(void))
+{
+    atomic_fetch_add(&blocked_acceptors, 1);
+    while (1) {
+        int seen = atomic_load(&done_seq);
+        if (cond()) {
+            break;
+        }
+        futexWait(&done_seq, seen);
+    }
+    atomic_fetch_sub(&blocked_acceptors, 1);
+}
+
+static int regularSlotFree(void)
+{
+    return atomic_load(&running_count) + queuedRegular() < poolSize;
+}
+
+static int vipSlotFree(void)
+{
+    return atomic_load(&running_count) + queuedRegular() +
+           atomic_load(&vip_queued) < poolSize;
+}
+
+static int allDone(void)
+{
+    return atomic_load(&running_count) == 0 && queuedRegular() == 0;
+}
+
+// Takes the oldest entry of one worker queue, or NULL if it is empty
+static Node workerQueueTake(workerQueue *q)
+{
+    if (atomic_load(&q->size) == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&q->lock);
+    Node node = removeFront(q->requests);
+    if (node != NULL) {
+        atomic_fetch_sub(&q->size, 1);
+        atomic_fetch_sub(&steal_waiting, 1);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return node;
+}
+
+// Own queue first, then steal from the peers that follow us
+static Node stealTake(int self)
+{
+    for (int k = 0; k < worker_count; k++) {
+        Node node = workerQueueTake(&worker_queues[(self + k) % worker_count]);
+        if (node != NULL) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static void parkWorker(int self)
+{
+    if (handoff == HANDOFF_STEAL) {
+        workerQueue *q = &worker_queues[self];
+        atomic_store(&q->idle, 1);
+        int seen = atomic_load(&q->wake_seq);
+        if (atomic_load(&steal_waiting) == 0) {
+            futexWait(&q->wake_seq, seen);
+        }
+        atomic_store(&q->idle, 0);
+        return;
+    }
+    atomic_fetch_add(&idle_workers, 1);
+    int seen = atomic_load(&ready_seq);
+    if (ringSize(ready_ring) == 0) {
+        futexWait(&ready_seq, seen);
+    }
+    atomic_fetch_sub(&idle_workers, 1);
+}
+
+// Wakes worker i if it is parked. Returns 1 if we were the one to claim it.
+static int wakeWorker(int i)
+{
+    workerQueue *q = &worker_queues[i];
+    int expected = 1;
+    if (!atomic_compare_exchange_strong(&q->idle, &expected, 0)) {
+        return 0;
+    }
+    atomic_fetch_add(&q->wake_seq, 1);
+    futexWake(&q->wake_seq, 1);
+    return 1;
+}
+
+// Worker side: blocks until a regular request may start and claims it.
+// running_count is raised only once a pop succeeds: raising it first
+// would make every idle worker polling an empty queue count as load.
+// Between the pop and the increment a request is briefly in neither
+// place, which can at most let admission take one more request early.
+static Node lockFreeNext(int self)
+{
+    // VIP first: stay off the queues while VIP work is queued, or in
+    // exclusive mode also while it is running
+    atomic_int *vipGate = vip_exclusive ? &vip_pending : &vip_queued;
+
+    while (1) {
+        int vip = atomic_load(vipGate);
+        if (vip > 0) {
+            futexWait(vipGate, vip);
+            continue;
+        }
+        Node node = (handoff == HANDOFF_STEAL) ? stealTake(self)
+                                               : ringPop(ready_ring);
+        if (node != NULL) {
+            atomic_fetch_add(&running_count, 1);
+            return node;
+        }
+        parkWorker(self);
+    }
+}
+
+void *LockFreeThreadFunction(void *args)
+{
+    threadStats *threadStruct = (threadStats *)args;
+    workerQueue *own = (handoff == HANDOFF_STEAL) ? &worker_queues[threadStruct->id] : NULL;
+
+    while (1) {
+        Node toWorkWith = lockFreeNext(threadStruct->id);
+        if (codel_enabled && codelDrop(toWorkWith)) {
+            metricsCountDrop(DROP_CODEL, 1);
+            Close(getValue(toWorkWith));
+            nodeDestructor(toWorkWith);
+            lockFreeComplete();
+            continue;
+        }
+        // Dispatch is stamped when the request is taken, stolen or not
+        dispatchNode(toWorkWith, threadStruct->id);
+        if (own != NULL) {
+            atomic_store(&own->busy, 1);
+        }
+
+        int fd = getValue(toWorkWith);
+        phaseStart(threadStruct, eventArrivalClock(fd), eventParsedClock(fd),
+                   getEnqueueTime(toWorkWith));
+        int keep = requestHandle(fd, eventRequest(fd), toWorkWith, threadStruct, eventCanKeepAlive(fd));
+        recordLatency(threadStruct, toWorkWith);
+        nodeDestructor(toWorkWith);
+        if (own != NULL) {
+            atomic_store(&own->busy, 0);
+        }
+        lockFreeComplete();
+
+        if (keep) {
+            eventPark(fd);
+        } else {
+            Close(fd);
+        }
+    }
+    return NULL;
+}
+
+static void lockFreePush(Node node)
+{
+    if (!ringPush(ready_ring, node)) {
+        // Cannot happen while admission holds the count below poolSize
+        Close(getValue(node));
+        nodeDestructor(node);
+        return;
+    }
+    atomic_fetch_add(&ready_seq, 1);
+    if (atomic_load(&idle_workers) > 0) {
+        futexWake(&ready_seq, 1);
+    }
+}
+
+static int pickWorker(void)
+{
+    if (!distribute_least) {
+        return atomic_fetch_add(&next_worker, 1) % worker_count;
+    }
+    int best = 0, bestLoad = INT_MAX;
+    for (int i = 0; i < worker_count; i++) {
+        int load = atomic_load(&worker_queues[i].size) +
+                   atomic_load(&worker_queues[i].busy);
+        if (load < bestLoad) {
+            best = i;
+            bestLoad = load;
+        }
+    }
+    return best;
+}
+
+static void stealPush(int connfd, struct timeval arrival_time)
+{
+    int target = pickWorker();
+    workerQueue *q = &worker_queues[target];
+
+    pthread_mutex_lock(&q->lock);
+    int rc = appendNewRequest(q->requests, connfd, arrival_time);
+    if (rc > 0) {
+        atomic_fetch_add(&q->size, 1);
+        atomic_fetch_add(&steal_waiting, 1);
+    }
+    pthread_mutex_unlock(&q->lock);
+    if (rc < 0) {
+        Close(connfd);
+        return;
+    }
+
+    // Prefer the owner; if it is busy, let any idle peer steal the entry
+    if (wakeWorker(target)) {
+        return;
+    }
+    for (int k = 1; k < worker_count; k++) {
+        if (wakeWorker((target + k) % worker_count)) {
+            return;
+        }
+    }
+}
+
+// Drop-head in steal mode: the oldest head over all worker queues
+static Node stealTakeOldest(void)
+{
+    int oldest = -1;
+    struct timeval best;
+    for (int i = 0; i < worker_count; i++) {
+        workerQueue *q = &worker_queues[i];
+        pthread_mutex_lock(&q->lock);
+        Node head = peekFront(q->requests);
+        if (head != NULL) {
+            struct timeval t = getArrivalTime(head);
+            if (oldest < 0 || timercmp(&t, &best, <)) {
+                oldest = i;
+                best = t;
+            }
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    return oldest < 0 ? NULL : workerQueueTake(&worker_queues[oldest]);
+}
+
+// Random policy in steal mode: drop half of every worker queue at random
+static int stealDropRandom(void)
+{
+    int seen = 0;
+    pthread_mutex_lock(&drain_lock);
+    for (int i = 0; i < worker_count; i++) {
+        workerQueue *q = &worker_queues[i];
+        pthread_mutex_lock(&q->lock);
+        int size = getSize(q->requests);
+        int dropped = removeRandom(q->requests, (size + 1) / 2, drop_buf);
+        atomic_fetch_sub(&q->size, dropped);
+        atomic_fetch_sub(&steal_waiting, dropped);
+        pthread_mutex_unlock(&q->lock);
+        metricsCountDrop(DROP_RANDOM, dropped);
+        for (int j = 0; j < dropped; j++) {
+            Close(drop_buf[j]);
+        }
+        seen += size;
+    }
+    pthread_mutex_unlock(&drain_lock);
+    return seen;
+}
+
+// Random policy without a lock on the ring: drain it, drop half of the
+// entries by selection sampling (which keeps the survivors in order)
+// and push the survivors back.
+static int lockFreeDropRandom()
+{
+    if (handoff == HANDOFF_STEAL) {
+        return stealDropRandom();
+    }
+    pthread_mutex_lock(&drain_lock);
+    int n = 0;
+    Node node;
+    while (n < poolSize && (node = ringPop(ready_ring)) != NULL) {
+        drain_buf[n++] = node;
+    }
+    int toDrop = (n + 1) / 2;
+    for (int i = 0; i < n; i++) {
+        if (rand() % (n - i) < toDrop) {
+            metricsCountDrop(DROP_RANDOM, 1);
+            Close(getValue(drain_buf[i]));
+            nodeDestructor(drain_buf[i]);
+            toDrop--;
+        } else {
+            lockFreePush(drain_buf[i]);
+        }
+    }
+    pthread_mutex_unlock(&drain_lock);
+    return n;
+}
+
+static void admitLockFree(int connfd, struct timeval arrival_time, int isVIP)
+{
+    if (isVIP) {
+        waitForCompletions(vipSlotFree);
+        pthread_mutex_lock(&global_lock);
+        appendNewRequest(vip_requests, connfd, arrival_time);
+        atomic_fetch_add(&vip_queued, 1);
+        atomic_fetch_add(&vip_pending, 1);
+        pthread_cond_signal(&vip_allowed);
+        pthread_mutex_unlock(&global_lock);
+        return;
+    }
+
+    if (!regularSlotFree()) {
+        if (strcmp(schedAlg, "block") == 0) {
+            waitForCompletions(regularSlotFree);
+        }
+        else if (strcmp(schedAlg, "dt") == 0 || codel_enabled) {
+            metricsCountDrop(DROP_TAIL, 1);
+            Close(connfd);
+            return;
+        }
+        else if (strcmp(schedAlg, "dh") == 0) {
+            Node oldest = (handoff == HANDOFF_STEAL) ? stealTakeOldest()
+                                                     : ringPop(ready_ring);
+            if (oldest == NULL) {
+                metricsCountDrop(DROP_TAIL, 1);
+                Close(connfd);
+                return;
+            }
+            metricsCountDrop(DROP_HEAD, 1);
+            Close(getValue(oldest));
+            nodeDestructor(oldest);
+        }
+        else if (strcmp(schedAlg, "bf") == 0) {
+            waitForCompletions(allDone);
+            metricsCountDrop(DROP_FLUSH, 1);
+            Close(connfd);
+            return;
+        }
+        else if (strcmp(schedAlg, "random") == 0) {
+            if (lockFreeDropRandom() == 0) {
+                metricsCountDrop(DROP_TAIL, 1);
+                Close(connfd);
+                return;
+            }
+        }
+    }
+
+    if (handoff == HANDOFF_STEAL) {
+        stealPush(connfd, arrival_time);
+        return;
+    }
+    Node node = nodeConstructor(connfd, arrival_time);
+    if (node == NULL) {
+        Close(connfd);
+        return;
+    }
+    lockFreePush(node);
+}
+
 // --------------------------------------------------
 // Parse command-line arguments
 // --------------------------------------------------
-void getArguments(int *port, int *threadsNum, int *poolSize,
-                  char *schedAlg, int argc, char *argv[])
+
+// Optional settings, given as "--name value" pairs after the
+// positional arguments.
+typedef struct serverOptions {
+    int keepaliveTimeout;   // seconds a kept-alive connection may idle, 0 = off
+    int keepaliveMax;       // requests served per connection
+    int headerTimeout;      // seconds a new connection has to send its head, 0 = off
+    int staticIO;           // STATIC_IO_MMAP or STATIC_IO_SENDFILE
+    int precompressed;      // ENCODING_* flags of siblings to serve, 0 = off
+    size_t cacheBytes;      // static content cache budget, 0 = off
+    int handoff;            // HANDOFF_LOCK, HANDOFF_LOCKFREE or HANDOFF_STEAL
+    int distributeLeast;    // steal mode: least-loaded instead of round-robin
+    int acceptors;          // acceptor threads, one SO_REUSEPORT socket each
+    int pinFirstCpu;        // pin acceptor i to cpu pinFirstCpu + i, -1 = off
+    int cgiPool;            // pre-spawned output.cgi processes, 0 = fork per request
+    int cgiTimeout;         // seconds a pooled process may take per request
+    int cgiSpawn;           // CGI_SPAWN_FORK or CGI_SPAWN_POSIX
+    int vipThreads;         // threads serving VIP requests
+    int vipExclusive;       // regular threads pause while any VIP request runs
+    int classCount;         // service classes given with --class, 0 = one FIFO
+    int classWeight[MAX_CLASSES];
+    char *classRules[MAX_CLASSES];  // "kind=pattern,..." or NULL for the default
+    int orderSff;           // smallest file first within each class
+    long long sffRate;      // bytes per second used to age SFF keys
+    int codelTargetMs;      // codel: acceptable standing queue delay
+    int codelIntervalMs;    // codel: how long it may be exceeded
+    double rateLimit;       // requests per second per client IP, 0 = off
+    double rateBurst;
+    double vipRateLimit;    // the same for VIP requests
+    double vipRateBurst;
+} serverOptions;
+
+// Parses a byte count with an optional K, M or G suffix
+static long long parseSize(char *value)
+{
+    char *end;
+    long long n = strtoll(value, &end, 10);
+    switch (*end) {
+        case 'K': case 'k': n <<= 10; end++; break;
+        case 'M': case 'm': n <<= 20; end++; break;
+        case 'G': case 'g': n <<= 30; end++; break;
+    }
+    return (*end == '\0' && end != value) ? n : -1;
+}
+
+// Parses "name:weight[:rules]" for --class. The name only documents the
+// class; classes are numbered in the order given.
+static void parseClass(char *value, serverOptions *opts)
 {
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s <portnum> <threads> <queue_size> <schedalg>\n", argv[0]);
+    if (opts->classCount == MAX_CLASSES) {
+        fprintf(stderr, "Error: At most %d classes.\n", MAX_CLASSES);
+        exit(1);
+    }
+    char *weight = strchr(value, ':');
+    int w = weight != NULL ? atoi(weight + 1) : 0;
+    if (w <= 0 || w > MAX_CLASS_WEIGHT) {
+        fprintf(stderr, "Error: Class weight must be between 1 and %d: %s\n",
+                MAX_CLASS_WEIGHT, value);
         exit(1);
     }
+    char *rules = strchr(weight + 1, ':');
+    if (rules != NULL) {
+        rules++;
+        // Validate now; setupClasses registers them
+        char copy[MAXLINE];
+        strncpy(copy, rules, MAXLINE - 1);
+        copy[MAXLINE - 1] = '\0';
+        for (char *rule = strtok(copy, ","); rule != NULL; rule = strtok(NULL, ",")) {
+            if ((strncmp(rule, "method=", 7) && strncmp(rule, "prefix=", 7) &&
+                 strncmp(rule, "header=", 7)) || rule[7] == '\0') {
+                fprintf(stderr, "Error: Bad class rule: %s\n", rule);
+                exit(1);
+            }
+        }
+    }
+    opts->classWeight[opts->classCount] = w;
+    opts->classRules[opts->classCount] = rules;
+    opts->classCount++;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "Usage: %s <portnum> <threads> <queue_size> <schedalg> [options]\n", prog);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --keepalive-timeout <sec>   keep idle connections open (default 0 = off)\n");
+    fprintf(stderr, "  --keepalive-max <n>         max requests per connection (default 100)\n");
+    fprintf(stderr, "  --header-timeout <sec>      close new connections that send no request\n");
+    fprintf(stderr, "                              head in time (default 10, 0 = off)\n");
+    fprintf(stderr, "  --static-io <mmap|sendfile> static file transfer method (default mmap)\n");
+    fprintf(stderr, "  --precompressed <br,gzip|off>\n");
+    fprintf(stderr, "                              serve .br / .gz siblings of text files (default off)\n");
+    fprintf(stderr, "  --cache-size <bytes[K|M|G]> static content cache budget (default 0 = off)\n");
+    fprintf(stderr, "  --handoff <lock|lockfree|steal>\n");
+    fprintf(stderr, "                              acceptor-to-worker queue (default lock)\n");
+    fprintf(stderr, "  --distribute <rr|least>     steal mode: how new requests pick a worker (default rr)\n");
+    fprintf(stderr, "  --acceptors <n>             acceptor threads with SO_REUSEPORT sockets (default 1)\n");
+    fprintf(stderr, "  --pin-acceptors <cpu>       pin acceptor i to core cpu + i (default off)\n");
+    fprintf(stderr, "  --cgi-pool <n>              persistent CGI processes (default 0 = fork per request)\n");
+    fprintf(stderr, "  --cgi-timeout <sec>         kill a pooled CGI process stuck this long (default 30)\n");
+    fprintf(stderr, "  --cgi-spawn <fork|posix_spawn>\n");
+    fprintf(stderr, "                              how per-request CGI processes start (default fork)\n");
+    fprintf(stderr, "  --vip-threads <n>           threads serving VIP requests (default 1)\n");
+    fprintf(stderr, "  --vip-mode <exclusive|priority>\n");
+    fprintf(stderr, "                              pause regular work while VIP runs, or only\n");
+    fprintf(stderr, "                              while VIP requests wait (default exclusive)\n");
+    fprintf(stderr, "  --class <name:weight[:rules]>\n");
+    fprintf(stderr, "                              weighted service class, weight 1 to 65536; rules\n");
+    fprintf(stderr, "                              are comma separated method=M, prefix=/p or\n");
+    fprintf(stderr, "                              header=Name[: value]\n");
+    fprintf(stderr, "  --order <fifo|sff>          order within a class (default fifo)\n");
+    fprintf(stderr, "  --sff-rate <bytes[K|M|G]>   sff: transfer rate per second for aging (default 100M)\n");
+    fprintf(stderr, "  --codel-target <ms>         codel: target queueing delay (default 5)\n");
+    fprintf(stderr, "  --codel-interval <ms>       codel: time above target before dropping (default 100)\n");
+    fprintf(stderr, "  --rate-limit <req/s>        requests per second per client IP (default 0 = off)\n");
+    fprintf(stderr, "  --rate-burst <n>            requests a client may send at once (default = rate)\n");
+    fprintf(stderr, "  --vip-rate-limit <req/s>    the same for VIP requests (default 0 = off)\n");
+    fprintf(stderr, "  --vip-rate-burst <n>        VIP burst (default = VIP rate)\n");
+    exit(1);
+}
+
+void getArguments(int *port, int *threadsNum, int *poolSize,
+                  char *schedAlg, serverOptions *opts, int argc, char *argv[])
+{
+    if (argc < 5 || (argc - 5) % 2 != 0) {
+        usage(argv[0]);
+    }
     *port = atoi(argv[1]);
     *threadsNum = atoi(argv[2]);
     if (*threadsNum <= 0) {
@@ -140,22 +962,293 @@ void getArguments(int *port, int *threadsNum, int *poolSize,
         exit(1);
     }
 
+    if (strlen(argv[4]) >= MAX_POLICY) {
+        fprintf(stderr, "Error: Unknown scheduling algorithm: %s\n", argv[4]);
+        exit(1);
+    }
     strcpy(schedAlg, argv[4]);
     if (strcmp(schedAlg, "block") != 0 &&
         strcmp(schedAlg, "dt")    != 0 &&
         strcmp(schedAlg, "dh")    != 0 &&
         strcmp(schedAlg, "bf")    != 0 &&
-        strcmp(schedAlg, "random")!= 0)
+        strcmp(schedAlg, "random")!= 0 &&
+        strcmp(schedAlg, "codel") != 0)
     {
         fprintf(stderr, "Error: Unknown scheduling algorithm: %s\n", schedAlg);
         exit(1);
     }
+
+    opts->keepaliveTimeout = 0;
+    opts->keepaliveMax     = 100;
+    opts->headerTimeout    = 10;
+    opts->staticIO         = STATIC_IO_MMAP;
+    opts->precompressed    = 0;
+    opts->cacheBytes       = 0;
+    opts->handoff          = HANDOFF_LOCK;
+    opts->distributeLeast  = 0;
+    opts->acceptors        = 1;
+    opts->pinFirstCpu      = -1;
+    opts->cgiPool          = 0;
+    opts->cgiTimeout       = 30;
+    opts->cgiSpawn         = CGI_SPAWN_FORK;
+    opts->vipThreads       = 1;
+    opts->vipExclusive     = 1;
+    opts->classCount       = 0;
+    opts->orderSff         = 0;
+    opts->sffRate          = 100LL << 20;
+    opts->codelTargetMs    = 5;
+    opts->codelIntervalMs  = 100;
+    opts->rateLimit        = 0;
+    opts->rateBurst        = 0;
+    opts->vipRateLimit     = 0;
+    opts->vipRateBurst     = 0;
+
+    for (int i = 5; i < argc; i += 2) {
+        char *name = argv[i], *value = argv[i + 1];
+        if (strcmp(name, "--keepalive-timeout") == 0) {
+            opts->keepaliveTimeout = atoi(value);
+            if (opts->keepaliveTimeout < 0) {
+                fprintf(stderr, "Error: keep-alive timeout must not be negative.\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--keepalive-max") == 0) {
+            opts->keepaliveMax = atoi(value);
+            if (opts->keepaliveMax <= 0) {
+                fprintf(stderr, "Error: keep-alive max must be positive.\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--header-timeout") == 0) {
+            opts->headerTimeout = atoi(value);
+            if (opts->headerTimeout < 0) {
+                fprintf(stderr, "Error: header timeout must not be negative.\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--static-io") == 0) {
+            if (strcmp(value, "mmap") == 0) {
+                opts->staticIO = STATIC_IO_MMAP;
+            } else if (strcmp(value, "sendfile") == 0) {
+                opts->staticIO = STATIC_IO_SENDFILE;
+            } else {
+                fprintf(stderr, "Error: Unknown static I/O method: %s\n", value);
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--precompressed") == 0) {
+            char copy[MAXLINE];
+            strncpy(copy, value, MAXLINE - 1);
+            copy[MAXLINE - 1] = '\0';
+            for (char *coding = strtok(copy, ","); coding != NULL; coding = strtok(NULL, ",")) {
+                if (strcmp(coding, "gzip") == 0) {
+                    opts->precompressed |= ENCODING_GZIP;
+                } else if (strcmp(coding, "br") == 0) {
+                    opts->precompressed |= ENCODING_BR;
+                } else if (strcmp(coding, "off") == 0) {
+                    opts->precompressed = 0;
+                } else {
+                    fprintf(stderr, "Error: Unknown content encoding: %s\n", coding);
+                    exit(1);
+                }
+            }
+        }
+        else if (strcmp(name, "--cache-size") == 0) {
+            long long bytes = parseSize(value);
+            if (bytes < 0) {
+                fprintf(stderr, "Error: Invalid cache size: %s\n", value);
+                exit(1);
+            }
+            opts->cacheBytes = bytes;
+        }
+        else if (strcmp(name, "--handoff") == 0) {
+            if (strcmp(value, "lock") == 0) {
+                opts->handoff = HANDOFF_LOCK;
+            } else if (strcmp(value, "lockfree") == 0) {
+                opts->handoff = HANDOFF_LOCKFREE;
+            } else if (strcmp(value, "steal") == 0) {
+                opts->handoff = HANDOFF_STEAL;
+            } else {
+                fprintf(stderr, "Error: Unknown handoff: %s\n", value);
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--distribute") == 0) {
+            if (strcmp(value, "rr") == 0) {
+                opts->distributeLeast = 0;
+            } else if (strcmp(value, "least") == 0) {
+                opts->distributeLeast = 1;
+            } else {
+                fprintf(stderr, "Error: Unknown distribution: %s\n", value);
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--acceptors") == 0) {
+            opts->acceptors = atoi(value);
+            if (opts->acceptors <= 0) {
+                fprintf(stderr, "Error: #acceptors must be positive.\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--pin-acceptors") == 0) {
+            opts->pinFirstCpu = atoi(value);
+            if (opts->pinFirstCpu < 0) {
+                fprintf(stderr, "Error: cpu must not be negative.\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--cgi-pool") == 0) {
+            opts->cgiPool = atoi(value);
+            if (opts->cgiPool < 0) {
+                fprintf(stderr, "Error: CGI pool size must not be negative.\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--cgi-timeout") == 0) {
+            opts->cgiTimeout = atoi(value);
+            if (opts->cgiTimeout <= 0) {
+                fprintf(stderr, "Error: CGI timeout must be positive.\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--cgi-spawn") == 0) {
+            if (strcmp(value, "fork") == 0) {
+                opts->cgiSpawn = CGI_SPAWN_FORK;
+            } else if (strcmp(value, "posix_spawn") == 0) {
+                opts->cgiSpawn = CGI_SPAWN_POSIX;
+            } else {
+                fprintf(stderr, "Error: Unknown CGI spawn method: %s\n", value);
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--vip-threads") == 0) {
+            opts->vipThreads = atoi(value);
+            if (opts->vipThreads <= 0) {
+                fprintf(stderr, "Error: #VIP threads must be positive.\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--vip-mode") == 0) {
+            if (strcmp(value, "exclusive") == 0) {
+                opts->vipExclusive = 1;
+            } else if (strcmp(value, "priority") == 0) {
+                opts->vipExclusive = 0;
+            } else {
+                fprintf(stderr, "Error: Unknown VIP mode: %s\n", value);
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--class") == 0) {
+            parseClass(value, opts);
+        }
+        else if (strcmp(name, "--order") == 0) {
+            if (strcmp(value, "fifo") == 0) {
+                opts->orderSff = 0;
+            } else if (strcmp(value, "sff") == 0) {
+                opts->orderSff = 1;
+            } else {
+                fprintf(stderr, "Error: Unknown order: %s\n", value);
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--codel-target") == 0) {
+            opts->codelTargetMs = atoi(value);
+            if (opts->codelTargetMs <= 0) {
+                fprintf(stderr, "Error: CoDel target must be positive.\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--codel-interval") == 0) {
+            opts->codelIntervalMs = atoi(value);
+            if (opts->codelIntervalMs <= 0) {
+                fprintf(stderr, "Error: CoDel interval must be positive.\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(name, "--rate-limit") == 0 ||
+                 strcmp(name, "--rate-burst") == 0 ||
+                 strcmp(name, "--vip-rate-limit") == 0 ||
+                 strcmp(name, "--vip-rate-burst") == 0) {
+            double v = atof(value);
+            if (v < 0) {
+                fprintf(stderr, "Error: %s must not be negative.\n", name);
+                exit(1);
+            }
+            if (strcmp(name, "--rate-limit") == 0)          opts->rateLimit    = v;
+            else if (strcmp(name, "--rate-burst") == 0)     opts->rateBurst    = v;
+            else if (strcmp(name, "--vip-rate-limit") == 0) opts->vipRateLimit = v;
+            else                                            opts->vipRateBurst = v;
+        }
+        else if (strcmp(name, "--sff-rate") == 0) {
+            opts->sffRate = parseSize(value);
+            if (opts->sffRate <= 0) {
+                fprintf(stderr, "Error: Invalid SFF rate: %s\n", value);
+                exit(1);
+            }
+        }
+        else {
+            fprintf(stderr, "Error: Unknown option: %s\n", name);
+            usage(argv[0]);
+        }
+    }
+    if (opts->classCount > 0 && opts->handoff != HANDOFF_LOCK) {
+        fprintf(stderr, "Error: --class needs --handoff lock.\n");
+        exit(1);
+    }
+    // Bursts default to one second worth of requests; a burst below one
+    // token would never admit anything
+    if (opts->rateBurst < 1) {
+        opts->rateBurst = opts->rateLimit > 1 ? opts->rateLimit : 1;
+    }
+    if (opts->vipRateBurst < 1) {
+        opts->vipRateBurst = opts->vipRateLimit > 1 ? opts->vipRateLimit : 1;
+    }
+    if (opts->orderSff && opts->handoff != HANDOFF_LOCK) {
+        fprintf(stderr, "Error: --order sff needs --handoff lock.\n");
+        exit(1);
+    }
+}
+
+// Builds the class queues and hands the matching rules to request.c.
+// Without --class everything waits in a single FIFO class.
+static void setupClasses(serverOptions *opts)
+{
+    int defaultClass = -1;
+
+    class_count = opts->classCount > 0 ? opts->classCount : 1;
+    for (int i = 0; i < class_count; i++) {
+        classes[i].requests = queueConstructorArray(poolSize);
+        classes[i].ordered = sff_rate > 0 ? heapConstructor(poolSize) : NULL;
+        classes[i].weight = opts->classCount > 0 ? opts->classWeight[i] : 1;
+        classes[i].pass = 0;
+
+        char *rules = opts->classCount > 0 ? opts->classRules[i] : NULL;
+        if (rules == NULL) {
+            if (defaultClass < 0) {
+                defaultClass = i;
+            }
+            continue;
+        }
+        for (char *rule = strtok(rules, ","); rule != NULL; rule = strtok(NULL, ",")) {
+            char *pattern = strchr(rule, '=') + 1;
+            int kind = !strncmp(rule, "method=", 7) ? CLASS_MATCH_METHOD :
+                       !strncmp(rule, "prefix=", 7) ? CLASS_MATCH_PREFIX :
+                                                      CLASS_MATCH_HEADER;
+            if (requestAddClassRule(i, kind, pattern) < 0) {
+                fprintf(stderr, "Error: More than %d class rules.\n", MAX_CLASS_RULES);
+                exit(1);
+            }
+        }
+    }
+    // Unmatched requests go to the first class without rules, or share
+    // the last class if every class has rules
+    requestSetDefaultClass(defaultClass >= 0 ? defaultClass : class_count - 1);
 }
 
 // --------------------------------------------------
-// Initialize threads: <num> regular + 1 VIP
+// Initialize threads: <num> regular + <vipNum> VIP
 // --------------------------------------------------
-void initializeThreads(int num, threadStats *threadsArr, pthread_t *vipThread)
+void initializeThreads(int num, int vipNum, threadStats *threadsArr)
 {
     for (int i = 0; i < num; i++) {
         threadsArr[i].id        = i;
@@ -164,16 +1257,182 @@ void initializeThreads(int num, threadStats *threadsArr, pthread_t *vipThread)
         threadsArr[i].total_req = 0;
 
         pthread_create(&threadsArr[i].ourThread, NULL,
-                       ThreadFunction, (void *)&threadsArr[i]);
+                       handoff != HANDOFF_LOCK ? LockFreeThreadFunction : ThreadFunction,
+                       (void *)&threadsArr[i]);
+    }
+
+    // VIP in [num, num + vipNum)
+    for (int i = num; i < num + vipNum; i++) {
+        threadsArr[i].id        = i;
+        threadsArr[i].dynm_req  = 0;
+        threadsArr[i].stat_req  = 0;
+        threadsArr[i].total_req = 0;
+
+        pthread_create(&threadsArr[i].ourThread, NULL, VIPThreadFunction,
+                       (void *)&threadsArr[i]);
     }
+}
 
-    // VIP in [num]
-    threadsArr[num].id        = num;
-    threadsArr[num].dynm_req  = 0;
-    threadsArr[num].stat_req  = 0;
-    threadsArr[num].total_req = 0;
+// /metrics is answered on the event loop, but still pays the
+// client's rate like any other request
+static int serveInline(int connfd, httpRequest *req)
+{
+    if (!metricsWanted(req)) {
+        return 0;
+    }
+    if (rateLimitEnabled() && !rateLimitTake(eventPeerAddr(connfd), 0)) {
+        metricsCountDrop(DROP_RATELIMIT, 1);
+        Close(connfd);
+        return 1;
+    }
+    metricsServe(connfd);
+    return 1;
+}
 
-    pthread_create(vipThread, NULL, VIPThreadFunction, (void *)&threadsArr[num]);
+static void dispatchLockFree(int connfd, struct timeval arrival_time, int isVIP)
+{
+    pthread_mutex_lock(&admit_lock);
+    admitLockFree(connfd, arrival_time, isVIP);
+    pthread_mutex_unlock(&admit_lock);
+}
+
+// --------------------------------------------------
+// Admit a connection whose request head has been parsed
+// --------------------------------------------------
+void dispatchConnection(int connfd, struct timeval arrival_time)
+{
+    // The head is already parsed, so classifying never blocks
+    // and can be done before taking the lock.
+    requestMeta meta;
+    int isVIP = getRequestMetaData(eventRequest(connfd), &meta);
+
+    // Over its rate, a client's request never reaches a queue
+    if (rateLimitEnabled() && !rateLimitTake(eventPeerAddr(connfd), isVIP)) {
+        metricsCountDrop(DROP_RATELIMIT, 1);
+        Close(connfd);
+        return;
+    }
+
+    if (handoff != HANDOFF_LOCK) {
+        dispatchLockFree(connfd, arrival_time, isVIP);
+        return;
+    }
+
+    pthread_mutex_lock(&global_lock);
+
+    if (isVIP) {
+        // VIP
+        while ( (getSize(running_requests) +
+                 waiting_count +
+                 getSize(vip_requests)) >= poolSize )
+        {
+            pthread_cond_wait(&write_allowed, &global_lock);
+        }
+        appendNewRequest(vip_requests, connfd, arrival_time);
+        pthread_cond_signal(&vip_allowed);
+    } else {
+        // Regular
+        if ( (getSize(running_requests) + waiting_count) == poolSize ) {
+            // Overloaded => apply schedAlg
+            if (strcmp(schedAlg, "block") == 0) {
+                while ((getSize(running_requests) + waiting_count) == poolSize) {
+                    pthread_cond_wait(&write_allowed, &global_lock);
+                }
+            }
+            else if (strcmp(schedAlg, "dt") == 0 || codel_enabled) {
+                // drop tail => close new (codel also drops at dequeue)
+                metricsCountDrop(DROP_TAIL, 1);
+                Close(connfd);
+                pthread_mutex_unlock(&global_lock);
+                return;
+            }
+            else if (strcmp(schedAlg, "dh") == 0) {
+                // drop head => remove oldest from waiting
+                if (waiting_count > 0) {
+                    Node oldest = classTakeOldest();
+                    metricsCountDrop(DROP_HEAD, 1);
+                    Close(getValue(oldest));
+                    nodeDestructor(oldest);
+                } else {
+                    metricsCountDrop(DROP_TAIL, 1);
+                    Close(connfd);
+                    pthread_mutex_unlock(&global_lock);
+                    return;
+                }
+            }
+            else if (strcmp(schedAlg, "bf") == 0) {
+                // block_flush => wait all done, then drop new
+                while ( (getSize(running_requests) > 0) ||
+                        (waiting_count > 0) )
+                {
+                    pthread_cond_wait(&empty_queue, &global_lock);
+                }
+                metricsCountDrop(DROP_FLUSH, 1);
+                Close(connfd);
+                pthread_mutex_unlock(&global_lock);
+                return;
+            }
+            else if (strcmp(schedAlg, "random") == 0) {
+                // Drop ~50% of waiting requests at random
+                if (waiting_count == 0) {
+                    // no waiting => close new
+                    metricsCountDrop(DROP_TAIL, 1);
+                    Close(connfd);
+                    pthread_mutex_unlock(&global_lock);
+                    return;
+                }
+                // half of each class => round up
+                classDropRandom();
+            }
+        }
+        // now we can accept the new request
+        classAppend(meta.cls, connfd, arrival_time, &meta);
+        pthread_cond_signal(&read_allowed);
+    }
+
+    pthread_mutex_unlock(&global_lock);
+}
+
+// --------------------------------------------------
+// Acceptor threads
+// --------------------------------------------------
+typedef struct acceptorArgs {
+    EventLoop loop;
+    int cpu;            // -1 = not pinned
+} acceptorArgs;
+
+void *AcceptorThreadFunction(void *args)
+{
+    acceptorArgs *acceptor = (acceptorArgs *)args;
+
+    if (acceptor->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(acceptor->cpu % CPU_SETSIZE, &set);
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (rc != 0) {
+            fprintf(stderr, "Warning: cannot pin acceptor to cpu %d: %s\n",
+                    acceptor->cpu, strerror(rc));
+        }
+    }
+    eventLoopRun(acceptor->loop);
+    return NULL;
+}
+
+// Queue sizes for /metrics
+static void collectGauges(metricsGauges *out)
+{
+    if (handoff == HANDOFF_LOCK) {
+        pthread_mutex_lock(&global_lock);
+        out->vip     = getSize(vip_requests);
+        out->waiting = waiting_count;
+        out->running = getSize(running_requests);
+        pthread_mutex_unlock(&global_lock);
+        return;
+    }
+    out->vip     = atomic_load(&vip_queued);
+    out->waiting = queuedRegular();
+    out->running = atomic_load(&running_count);
 }
 
 // --------------------------------------------------
@@ -181,17 +1440,56 @@ void initializeThreads(int num, threadStats *threadsArr, pthread_t *vipThread)
 // --------------------------------------------------
 int main(int argc, char *argv[])
 {
-    int listenfd, connfd, clientlen;
-    struct sockaddr_in clientaddr;
-    int port, threadNum, poolSize;
-    char schedAlg[MAX_POLICY];
+    int listenfd;
+    int port, threadNum;
+    serverOptions opts;
 
-    getArguments(&port, &threadNum, &poolSize, schedAlg, argc, argv);
+    getArguments(&port, &threadNum, &poolSize, schedAlg, &opts, argc, argv);
+    // A client that hangs up mid-response must cost its connection, not
+    // the server: writes to it fail with EPIPE instead
+    signal(SIGPIPE, SIG_IGN);
+    eventSetKeepAlive(opts.keepaliveTimeout, opts.keepaliveMax);
+    eventSetHeaderTimeout(opts.headerTimeout);
+    requestEnableKeepAlive(opts.keepaliveTimeout > 0);
+    requestSetStaticIO(opts.staticIO);
+    requestSetPrecompressed(opts.precompressed);
+    cacheInit(opts.cacheBytes);
+    rateLimitInit(opts.rateLimit, opts.rateBurst, opts.vipRateLimit, opts.vipRateBurst);
+    requestSetCgiSpawn(opts.cgiSpawn);
+    cgiPoolInit("./public/output.cgi", opts.cgiPool, opts.cgiTimeout);
 
-    // init queues
+    // init queues; VIP admission counts every queue but regular admission
+    // ignores vip_requests, so up to 2 * poolSize nodes can be live at once
+    queuePoolInit(2 * poolSize);
     vip_requests     = queueConstructor();
     running_requests = queueConstructor();
-    waiting_requests = queueConstructor();
+    sff_rate = opts.orderSff ? opts.sffRate : 0;
+    codel_enabled = (strcmp(schedAlg, "codel") == 0);
+    codel_target = opts.codelTargetMs * 1000LL;
+    codel_interval = opts.codelIntervalMs * 1000LL;
+    requestSetStatAtAdmission(opts.orderSff);
+    setupClasses(&opts);
+    drop_buf = (int *)malloc(sizeof(int) * poolSize);
+
+    handoff = opts.handoff;
+    vip_exclusive = opts.vipExclusive;
+    distribute_least = opts.distributeLeast;
+    if (handoff == HANDOFF_LOCKFREE) {
+        ready_ring = ringConstructor(poolSize);
+        drain_buf = (Node *)malloc(sizeof(Node) * poolSize);
+    }
+    if (handoff == HANDOFF_STEAL) {
+        worker_count = threadNum;
+        worker_queues = (workerQueue *)aligned_alloc(64, sizeof(workerQueue) * threadNum);
+        for (int i = 0; i < threadNum; i++) {
+            pthread_mutex_init(&worker_queues[i].lock, NULL);
+            worker_queues[i].requests = queueConstructorArray(poolSize);
+            atomic_init(&worker_queues[i].size, 0);
+            atomic_init(&worker_queues[i].busy, 0);
+            atomic_init(&worker_queues[i].idle, 0);
+            atomic_init(&worker_queues[i].wake_seq, 0);
+        }
+    }
 
     // init sync
     pthread_cond_init(&empty_queue, NULL);
@@ -201,100 +1499,34 @@ int main(int argc, char *argv[])
     pthread_mutex_init(&global_lock, NULL);
 
     // thread array
-    threadStats *threadArr = (threadStats *)malloc(sizeof(threadStats)*(threadNum+1));
-    pthread_t vipThread;
+    // Cache-line aligned, so each thread's counters sit on lines of their own
+    threadStats *threadArr = (threadStats *)aligned_alloc(64, sizeof(threadStats)*(threadNum+opts.vipThreads));
+    memset(threadArr, 0, sizeof(threadStats)*(threadNum+opts.vipThreads));
+    metricsInit(threadArr, threadNum + opts.vipThreads, collectGauges);
+    eventSetInlineHandler(serveInline);
 
     // create threads
-    initializeThreads(threadNum, threadArr, &vipThread);
+    initializeThreads(threadNum, opts.vipThreads, threadArr);
 
-    listenfd = Open_listenfd(port);
     srand(time(NULL)); // for random dropping
 
-    while (1) {
-        clientlen = sizeof(clientaddr);
-        connfd = Accept(listenfd, (SA *)&clientaddr, (socklen_t *)&clientlen);
-
-        // arrival time
-        struct timeval arrival_time;
-        gettimeofday(&arrival_time, NULL);
-
-        pthread_mutex_lock(&global_lock);
-
-        int isVIP = getRequestMetaData(connfd);
-        if (isVIP) {
-            // VIP
-            while ( (getSize(running_requests) +
-                     getSize(waiting_requests) +
-                     getSize(vip_requests)) >= poolSize )
-            {
-                pthread_cond_wait(&write_allowed, &global_lock);
-            }
-            appendNewRequest(vip_requests, connfd, arrival_time);
-            pthread_cond_signal(&vip_allowed);
-        } else {
-            // Regular
-            if ( (getSize(running_requests) + getSize(waiting_requests)) == poolSize ) {
-                // Overloaded => apply schedAlg
-                if (strcmp(schedAlg, "block") == 0) {
-                    while ((getSize(running_requests) + getSize(waiting_requests)) == poolSize) {
-                        pthread_cond_wait(&write_allowed, &global_lock);
-                    }
-                }
-                else if (strcmp(schedAlg, "dt") == 0) {
-                    // drop tail => close new
-                    Close(connfd);
-                    pthread_mutex_unlock(&global_lock);
-                    continue;
-                }
-                else if (strcmp(schedAlg, "dh") == 0) {
-                    // drop head => remove oldest from waiting
-                    if (getSize(waiting_requests) > 0) {
-                        Node oldest = removeFront(waiting_requests);
-                        Close(getValue(oldest));
-                    } else {
-                        Close(connfd);
-                        pthread_mutex_unlock(&global_lock);
-                        continue;
-                    }
-                }
-                else if (strcmp(schedAlg, "bf") == 0) {
-                    // block_flush => wait all done, then drop new
-                    while ( (getSize(running_requests) > 0) ||
-                            (getSize(waiting_requests) > 0) )
-                    {
-                        pthread_cond_wait(&empty_queue, &global_lock);
-                    }
-                    Close(connfd);
-                    pthread_mutex_unlock(&global_lock);
-                    continue;
-                }
-                else if (strcmp(schedAlg, "random") == 0) {
-                    // Drop ~50% of waiting requests at random
-                    int wsize = getSize(waiting_requests);
-                    if (wsize == 0) {
-                        // no waiting => close new
-                        Close(connfd);
-                        pthread_mutex_unlock(&global_lock);
-                        continue;
-                    }
-                    // half => round up
-                    int toDrop = (wsize + 1)/2;
-                    for (int i = 0; i < toDrop; i++) {
-                        int idx = rand() % getSize(waiting_requests);
-                        int oldFd = removeByIndex(waiting_requests, idx);
-                        Close(oldFd);
-                        if (getSize(waiting_requests) == 0) {
-                            break;
-                        }
-                    }
-                }
-            }
-            // now we can accept the new request
-            appendNewRequest(waiting_requests, connfd, arrival_time);
-            pthread_cond_signal(&read_allowed);
-        }
-
-        pthread_mutex_unlock(&global_lock);
+    // Non-blocking accept + readiness polling: slow or idle clients are
+    // parked in epoll and only reach the queues once they have spoken.
+    // With several acceptors each gets its own SO_REUSEPORT socket and
+    // loop, so the kernel spreads incoming connections across them.
+    // Loops are all built here, before any of them runs.
+    int acceptors = opts.acceptors;
+    acceptorArgs *acceptorArr = (acceptorArgs *)malloc(sizeof(acceptorArgs) * acceptors);
+    for (int i = 0; i < acceptors; i++) {
+        listenfd = (acceptors > 1) ? Open_listenfd_reuseport(port) : Open_listenfd(port);
+        acceptorArr[i].loop = eventLoopConstructor(listenfd, dispatchConnection);
+        acceptorArr[i].cpu  = (opts.pinFirstCpu >= 0) ? opts.pinFirstCpu + i : -1;
+    }
+    for (int i = 1; i < acceptors; i++) {
+        pthread_t tid;
+        pthread_create(&tid, NULL, AcceptorThreadFunction, (void *)&acceptorArr[i]);
     }
+    // The main thread is acceptor 0
+    AcceptorThreadFunction(&acceptorArr[0]);
     return 0;
 }